@@ -0,0 +1,172 @@
+#include "address.h"
+#include "pl_network.h"
+#include "pl_network_platform.h"
+#include <string.h>
+
+#if CONFIG_BENCHMARK_ADDRESS
+
+//==============================================================================
+
+const int numberOfIterations = CONFIG_BENCHMARK_ADDRESS_NUMBER_OF_ITERATIONS;
+const int numberOfTestAddresses = 64;
+// Prevents the measured operations from being optimized out
+static volatile uint32_t sink;
+
+//==============================================================================
+
+// xorshift32 (deterministic and available on all targets)
+static uint32_t Random() {
+  static uint32_t state = 2463534242;
+  state ^= state << 13;
+  state ^= state >> 17;
+  state ^= state << 5;
+  return state;
+}
+
+//==============================================================================
+
+static PL::IpV6Address RandomIpV6Address(uint8_t zoneId) {
+  return PL::IpV6Address(Random(), Random(), Random(), Random(), zoneId);
+}
+
+//==============================================================================
+
+static std::string RandomString(const char* characters) {
+  std::string string(Random() % 48, ' ');
+  for (auto& c : string)
+    c = characters[Random() % strlen(characters)];
+  return string;
+}
+
+//==============================================================================
+
+template <typename Operation>
+static double Measure(Operation operation) {
+  int64_t startTime = PL::GetTimeInMicroseconds();
+  for (int i = 0; i < numberOfIterations; i++)
+    operation(i % numberOfTestAddresses);
+  return (double)(PL::GetTimeInMicroseconds() - startTime) * 1000 / numberOfIterations;
+}
+
+//==============================================================================
+
+static void PrintResult(const char* operation, double time, double referenceTime, bool& firstResult) {
+  printf("%s\n{\"operation\":\"%s\",\"nsPerOperation\":%.1f", firstResult ? "" : ",", operation, time);
+  if (referenceTime >= 0)
+    printf(",\"referenceNsPerOperation\":%.1f", referenceTime);
+  printf("}");
+  fflush(stdout);
+  firstResult = false;
+}
+
+//==============================================================================
+
+static uint32_t CheckParity() {
+  uint32_t numberOfMismatches = 0;
+  char addressString[INET6_ADDRSTRLEN + 4];
+
+  for (int i = 0; i < numberOfIterations; i++) {
+    // IPv4 format and parse
+    PL::IpV4Address ipV4Address(Random());
+    inet_ntop(AF_INET, &ipV4Address.u32, addressString, sizeof(addressString));
+    if (ipV4Address.ToString() != addressString || PL::IpV4Address(addressString) != ipV4Address || PL::IpV4Address(ipV4Address.ToString()) != ipV4Address)
+      numberOfMismatches++;
+
+    // IPv6 format and parse (with and without zone ID)
+    PL::IpV6Address ipV6Address = RandomIpV6Address(Random());
+    PL::IpV6Address ipV6AddressWithoutZoneId(ipV6Address.u32[0], ipV6Address.u32[1], ipV6Address.u32[2], ipV6Address.u32[3]);
+    inet_ntop(AF_INET6, ipV6Address.u32, addressString, sizeof(addressString));
+    if (PL::IpV6Address(addressString) != ipV6AddressWithoutZoneId || PL::IpV6Address(ipV6Address.ToString()) != ipV6Address ||
+        PL::IpV6Address(std::string(addressString) + "%" + std::to_string(ipV6Address.zoneId)) != ipV6Address ||
+        PL::NetworkAddress(ipV6Address).ToString() != ipV6Address.ToString())
+      numberOfMismatches++;
+
+    // Random strings must be parsed like inet_pton does (zero address if invalid)
+    std::string string = RandomString(Random() % 2 ? "0123456789." : "0123456789abcdefABCDEF:.");
+    uint32_t u32[4] = {};
+    if (inet_pton(AF_INET, string.c_str(), u32) != 1)
+      u32[0] = 0;
+    if (PL::IpV4Address(string).u32 != u32[0])
+      numberOfMismatches++;
+    memset(u32, 0, sizeof(u32));
+    if (inet_pton(AF_INET6, string.c_str(), u32) != 1)
+      memset(u32, 0, sizeof(u32));
+    if (PL::IpV6Address(string) != PL::IpV6Address(u32[0], u32[1], u32[2], u32[3]))
+      numberOfMismatches++;
+
+    // Socket address conversion
+    sockaddr_storage sockAddr = {};
+    uint16_t port = Random();
+    if (Random() % 2) {
+      sockaddr_in& sockAddrIn = *(sockaddr_in*)&sockAddr;
+      sockAddrIn.sin_family = AF_INET;
+      sockAddrIn.sin_addr.s_addr = ipV4Address.u32;
+      sockAddrIn.sin_port = htons(port);
+      PL::NetworkEndpoint endpoint = PL::NetworkStream::SockAddrToEndpoint(sockAddr);
+      if (endpoint.address != PL::NetworkAddress(ipV4Address) || endpoint.port != port)
+        numberOfMismatches++;
+    }
+    else {
+      sockaddr_in6& sockAddrIn6 = *(sockaddr_in6*)&sockAddr;
+      sockAddrIn6.sin6_family = AF_INET6;
+      bool ipV4Mapped = Random() % 2;
+      if (ipV4Mapped) {
+        inet_pton(AF_INET6, ("::ffff:" + ipV4Address.ToString()).c_str(), &sockAddrIn6.sin6_addr);
+      }
+      else {
+        memcpy(&sockAddrIn6.sin6_addr, ipV6Address.u32, sizeof(ipV6Address.u32));
+        sockAddrIn6.sin6_scope_id = ipV6Address.zoneId;
+      }
+      sockAddrIn6.sin6_port = htons(port);
+      PL::NetworkEndpoint endpoint = PL::NetworkStream::SockAddrToEndpoint(sockAddr);
+      // A random address is IPv4-mapped with a negligible probability
+      if (endpoint.address != (ipV4Mapped ? PL::NetworkAddress(ipV4Address) : PL::NetworkAddress(ipV6Address)) || endpoint.port != port)
+        numberOfMismatches++;
+    }
+  }
+  return numberOfMismatches;
+}
+
+//==============================================================================
+
+bool RunAddressBenchmark() {
+  std::vector<PL::IpV4Address> ipV4Addresses;
+  std::vector<PL::IpV6Address> ipV6Addresses;
+  std::vector<std::string> ipV4Strings, ipV6Strings;
+  std::vector<sockaddr_storage> sockAddrs(numberOfTestAddresses);
+  char addressString[INET6_ADDRSTRLEN];
+  for (int i = 0; i < numberOfTestAddresses; i++) {
+    ipV4Addresses.push_back(PL::IpV4Address(Random()));
+    ipV6Addresses.push_back(RandomIpV6Address(0));
+    inet_ntop(AF_INET, &ipV4Addresses[i].u32, addressString, sizeof(addressString));
+    ipV4Strings.push_back(addressString);
+    inet_ntop(AF_INET6, ipV6Addresses[i].u32, addressString, sizeof(addressString));
+    ipV6Strings.push_back(addressString);
+    sockaddr_in6& sockAddrIn6 = *(sockaddr_in6*)&sockAddrs[i];
+    sockAddrIn6.sin6_family = AF_INET6;
+    memcpy(&sockAddrIn6.sin6_addr, ipV6Addresses[i].u32, sizeof(ipV6Addresses[i].u32));
+    sockAddrIn6.sin6_port = htons(i);
+  }
+
+  printf("{\"benchmark\":\"address\",\"target\":\"%s\",\"iterations\":%d,\"results\":[", CONFIG_IDF_TARGET, numberOfIterations);
+  bool firstResult = true;
+
+  PrintResult("IpV4Address(string)", Measure([&](int i) { sink = PL::IpV4Address(ipV4Strings[i]).u32; }),
+    Measure([&](int i) { uint32_t u32; inet_pton(AF_INET, ipV4Strings[i].c_str(), &u32); sink = u32; }), firstResult);
+  PrintResult("IpV4Address::ToString", Measure([&](int i) { sink = ipV4Addresses[i].ToString().size(); }),
+    Measure([&](int i) { char s[INET_ADDRSTRLEN]; inet_ntop(AF_INET, &ipV4Addresses[i].u32, s, sizeof(s)); sink = std::string(s).size(); }), firstResult);
+  PrintResult("IpV6Address(string)", Measure([&](int i) { sink = PL::IpV6Address(ipV6Strings[i]).u32[0]; }),
+    Measure([&](int i) { uint32_t u32[4]; inet_pton(AF_INET6, ipV6Strings[i].c_str(), u32); sink = u32[0]; }), firstResult);
+  PrintResult("IpV6Address::ToString", Measure([&](int i) { sink = ipV6Addresses[i].ToString().size(); }),
+    Measure([&](int i) { char s[INET6_ADDRSTRLEN]; inet_ntop(AF_INET6, ipV6Addresses[i].u32, s, sizeof(s)); sink = std::string(s).size(); }), firstResult);
+  PrintResult("NetworkAddress::ToString", Measure([&](int i) { sink = PL::NetworkAddress(ipV6Addresses[i]).ToString().size(); }), -1, firstResult);
+  PrintResult("NetworkStream::SockAddrToEndpoint", Measure([&](int i) { sink = PL::NetworkStream::SockAddrToEndpoint(sockAddrs[i]).port; }), -1, firstResult);
+
+  uint32_t numberOfMismatches = CheckParity();
+  printf("\n],\"parityMismatches\":%lu}\n", (unsigned long)numberOfMismatches);
+  return !numberOfMismatches;
+}
+
+//==============================================================================
+
+#endif
\ No newline at end of file
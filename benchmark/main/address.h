@@ -0,0 +1,6 @@
+#pragma once
+
+//==============================================================================
+
+// Returns false if any parity check failed
+bool RunAddressBenchmark();
\ No newline at end of file
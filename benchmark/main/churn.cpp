@@ -0,0 +1,129 @@
+#include "churn.h"
+#include "esp_check.h"
+#include <errno.h>
+#if !CONFIG_IDF_TARGET_LINUX
+#include "esp_heap_caps.h"
+#endif
+
+#if CONFIG_BENCHMARK_CHURN
+
+//==============================================================================
+
+const uint16_t port = 5003;
+const PL::IpV4Address ipV4Address(127, 0, 0, 1);
+static const char* TAG = "churn_benchmark";
+
+struct ChurnCounters {
+  uint32_t numberOfConnections = 0;
+  uint32_t numberOfConnectFailures = 0;
+  // socket()/connect() failed with ENFILE, EMFILE, ENOMEM or ENOBUFS (socket or PCB exhaustion)
+  uint32_t numberOfSocketExhaustionFailures = 0;
+  uint32_t numberOfExchangeFailures = 0;
+};
+
+//==============================================================================
+
+static esp_err_t RunConnection(ChurnCounters& counters) {
+  PL::TcpClient client(ipV4Address, port);
+  uint8_t message[ChurnServer::messageSize] = {};
+
+  if (client.Connect() != ESP_OK) {
+    int error = errno;
+    counters.numberOfConnectFailures++;
+    if (error == ENFILE || error == EMFILE || error == ENOMEM || error == ENOBUFS)
+      counters.numberOfSocketExhaustionFailures++;
+    return ESP_FAIL;
+  }
+  counters.numberOfConnections++;
+
+  auto stream = client.GetStream();
+  if (stream->Write(message, sizeof(message)) != ESP_OK || stream->Read(message, sizeof(message)) != ESP_OK) {
+    counters.numberOfExchangeFailures++;
+    client.Disconnect();
+    return ESP_FAIL;
+  }
+  return client.Disconnect();
+}
+
+//==============================================================================
+
+static void PrintReport(ChurnServer& server, const ChurnCounters& counters, int64_t time, uint32_t numberOfAcceptedConnectionsPerSecond, bool firstReport) {
+  PL::TcpServerStatistics statistics = server.GetStatistics();
+  uint32_t numberOfDisconnections = 0;
+  for (auto number : statistics.numberOfDisconnections)
+    numberOfDisconnections += number;
+
+  printf("%s\n{\"timeS\":%lld,\"connections\":%lu,\"connectFailures\":%lu,\"socketExhaustionFailures\":%lu,\"exchangeFailures\":%lu,"
+    "\"acceptedConnections\":%lu,\"acceptedConnectionsPerSecond\":%lu,\"disconnections\":%lu,\"errorDisconnections\":%lu,",
+    firstReport ? "" : ",", (long long)(time / 1000000), (unsigned long)counters.numberOfConnections, (unsigned long)counters.numberOfConnectFailures,
+    (unsigned long)counters.numberOfSocketExhaustionFailures, (unsigned long)counters.numberOfExchangeFailures,
+    (unsigned long)statistics.numberOfAcceptedConnections, (unsigned long)numberOfAcceptedConnectionsPerSecond, (unsigned long)numberOfDisconnections,
+    (unsigned long)statistics.numberOfDisconnections[(int)PL::NetworkStreamCloseReason::error]);
+#if CONFIG_IDF_TARGET_LINUX
+  printf("\"freeHeap\":null,\"minFreeHeap\":null,\"largestFreeBlock\":null}");
+#else
+  printf("\"freeHeap\":%lu,\"minFreeHeap\":%lu,\"largestFreeBlock\":%lu}", (unsigned long)heap_caps_get_free_size(MALLOC_CAP_DEFAULT),
+    (unsigned long)heap_caps_get_minimum_free_size(MALLOC_CAP_DEFAULT), (unsigned long)heap_caps_get_largest_free_block(MALLOC_CAP_DEFAULT));
+#endif
+  fflush(stdout);
+}
+
+//==============================================================================
+
+bool RunChurnBenchmark() {
+  ChurnServer server(port);
+  ESP_ERROR_CHECK(server.Enable());
+  vTaskDelay(10);
+
+  ChurnCounters counters;
+  const int64_t connectionPeriod = 1000000 / std::max(CONFIG_BENCHMARK_CHURN_CONNECTION_RATE, 1);
+  const int64_t reportPeriod = (int64_t)std::max(CONFIG_BENCHMARK_CHURN_REPORT_INTERVAL, 1) * 1000000;
+  const int64_t duration = (int64_t)CONFIG_BENCHMARK_CHURN_DURATION * 1000000;
+  int64_t startTime = PL::GetTimeInMicroseconds();
+  int64_t nextConnectionTime = startTime, nextReportTime = startTime + reportPeriod;
+  uint32_t lastNumberOfAcceptedConnections = 0;
+
+  printf("{\"benchmark\":\"churn\",\"target\":\"%s\",\"connectionRate\":%d,\"results\":[", CONFIG_IDF_TARGET, CONFIG_BENCHMARK_CHURN_CONNECTION_RATE);
+  bool firstReport = true;
+  while (!duration || PL::GetTimeInMicroseconds() - startTime < duration) {
+    RunConnection(counters);
+
+    int64_t time = PL::GetTimeInMicroseconds();
+    if (time >= nextReportTime) {
+      uint32_t numberOfAcceptedConnections = server.GetStatistics().numberOfAcceptedConnections;
+      PrintReport(server, counters, time - startTime, (uint32_t)((numberOfAcceptedConnections - lastNumberOfAcceptedConnections) * 1000000LL / reportPeriod), firstReport);
+      lastNumberOfAcceptedConnections = numberOfAcceptedConnections;
+      nextReportTime += reportPeriod;
+      firstReport = false;
+    }
+
+    nextConnectionTime += connectionPeriod;
+    // Do not try to catch up if the connections are slower than the requested rate
+    if (nextConnectionTime < time)
+      nextConnectionTime = time;
+    vTaskDelay(std::max<TickType_t>((nextConnectionTime - time) / 1000 / portTICK_PERIOD_MS, 1));
+  }
+  printf("\n]}\n");
+
+  server.Disable();
+  return !counters.numberOfConnectFailures && !counters.numberOfExchangeFailures;
+}
+
+//==============================================================================
+
+ChurnServer::ChurnServer(uint16_t port) : TcpServer(port) {}
+
+//==============================================================================
+
+esp_err_t ChurnServer::HandleRequest(PL::NetworkStream& clientStream) {
+  uint8_t message[messageSize];
+  if (clientStream.GetReadableSize() < sizeof(message))
+    return ESP_OK;
+  ESP_RETURN_ON_ERROR(clientStream.Read(message, sizeof(message)), TAG, "message read failed");
+  ESP_RETURN_ON_ERROR(clientStream.Write(message, sizeof(message)), TAG, "message write failed");
+  return ESP_OK;
+}
+
+//==============================================================================
+
+#endif
\ No newline at end of file
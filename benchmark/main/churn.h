@@ -0,0 +1,19 @@
+#pragma once
+#include "pl_network.h"
+
+//==============================================================================
+
+class ChurnServer : public PL::TcpServer {
+public:
+  static const size_t messageSize = 16;
+
+  ChurnServer(uint16_t port);
+
+protected:
+  esp_err_t HandleRequest(PL::NetworkStream& clientStream) override;
+};
+
+//==============================================================================
+
+// Returns false if any connection or message exchange failed
+bool RunChurnBenchmark();
\ No newline at end of file
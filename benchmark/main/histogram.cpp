@@ -0,0 +1,105 @@
+#include "histogram.h"
+#include <algorithm>
+#include <math.h>
+
+//==============================================================================
+
+Histogram::Histogram(uint32_t numberOfSubBucketBits) : numberOfSubBucketBits(std::min<uint32_t>(numberOfSubBucketBits, 16)),
+  counts((33 - this->numberOfSubBucketBits) << this->numberOfSubBucketBits) {}
+
+//==============================================================================
+
+void Histogram::Clear() {
+  std::fill(counts.begin(), counts.end(), 0);
+  count = 0;
+  sum = 0;
+  min = UINT32_MAX;
+  max = 0;
+}
+
+//==============================================================================
+
+void Histogram::Add(uint32_t value) {
+  counts[GetIndex(value)]++;
+  count++;
+  sum += value;
+  min = std::min(min, value);
+  max = std::max(max, value);
+}
+
+//==============================================================================
+
+void Histogram::Add(const Histogram& histogram) {
+  if (histogram.numberOfSubBucketBits == numberOfSubBucketBits) {
+    for (size_t i = 0; i < counts.size(); i++)
+      counts[i] += histogram.counts[i];
+  }
+  else {
+    for (size_t i = 0; i < histogram.counts.size(); i++)
+      counts[GetIndex(histogram.GetHighestValue(i))] += histogram.counts[i];
+  }
+  count += histogram.count;
+  sum += histogram.sum;
+  min = std::min(min, histogram.min);
+  max = std::max(max, histogram.max);
+}
+
+//==============================================================================
+
+uint64_t Histogram::GetCount() const {
+  return count;
+}
+
+//==============================================================================
+
+uint32_t Histogram::GetMin() const {
+  return count ? min : 0;
+}
+
+//==============================================================================
+
+uint32_t Histogram::GetMax() const {
+  return max;
+}
+
+//==============================================================================
+
+double Histogram::GetMean() const {
+  return count ? (double)sum / count : 0;
+}
+
+//==============================================================================
+
+uint32_t Histogram::GetPercentile(double percentile) const {
+  if (!count)
+    return 0;
+  uint64_t targetCount = std::max<uint64_t>((uint64_t)ceil(std::min(std::max(percentile, 0.0), 100.0) / 100 * count), 1);
+  uint64_t cumulativeCount = 0;
+  for (size_t i = 0; i < counts.size(); i++) {
+    cumulativeCount += counts[i];
+    if (cumulativeCount >= targetCount)
+      return std::min(GetHighestValue(i), max);
+  }
+  return max;
+}
+
+//==============================================================================
+
+size_t Histogram::GetIndex(uint32_t value) const {
+  uint32_t subBucketCount = 1 << numberOfSubBucketBits;
+  if (value < 2 * subBucketCount)
+    return value;
+  uint32_t shift = 31 - __builtin_clz(value) - numberOfSubBucketBits;
+  return shift * subBucketCount + (value >> shift);
+}
+
+//==============================================================================
+
+uint32_t Histogram::GetHighestValue(size_t index) const {
+  uint32_t subBucketCount = 1 << numberOfSubBucketBits;
+  if (index < 2 * subBucketCount)
+    return index;
+  uint32_t shift = index / subBucketCount - 1;
+  uint64_t subBucket = index - shift * subBucketCount;
+  return (uint32_t)std::min<uint64_t>(((subBucket + 1) << shift) - 1, UINT32_MAX);
+}
\ No newline at end of file
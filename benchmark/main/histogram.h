@@ -0,0 +1,34 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+//==============================================================================
+
+// Log-linear (HDR-style) histogram: each power-of-two range is split into 2^numberOfSubBucketBits linear buckets
+class Histogram {
+public:
+  static const uint32_t defaultNumberOfSubBucketBits = 5;
+
+  Histogram(uint32_t numberOfSubBucketBits = defaultNumberOfSubBucketBits);
+
+  void Clear();
+  void Add(uint32_t value);
+  void Add(const Histogram& histogram);
+
+  uint64_t GetCount() const;
+  uint32_t GetMin() const;
+  uint32_t GetMax() const;
+  double GetMean() const;
+  // Returns the highest value equivalent to the given percentile (0-100) bucket
+  uint32_t GetPercentile(double percentile) const;
+
+private:
+  uint32_t numberOfSubBucketBits;
+  std::vector<uint64_t> counts;
+  uint64_t count = 0, sum = 0;
+  uint32_t min = UINT32_MAX, max = 0;
+
+  size_t GetIndex(uint32_t value) const;
+  uint32_t GetHighestValue(size_t index) const;
+};
\ No newline at end of file
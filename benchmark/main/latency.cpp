@@ -0,0 +1,127 @@
+#include "latency.h"
+#include "esp_check.h"
+#include "freertos/semphr.h"
+
+#if CONFIG_BENCHMARK_LATENCY
+
+//==============================================================================
+
+const uint16_t port = 5002;
+const PL::IpV4Address ipV4Address(127, 0, 0, 1);
+const size_t messageSize = CONFIG_BENCHMARK_LATENCY_MESSAGE_SIZE;
+const int numberOfWarmUpRequests = 10;
+static const char* TAG = "latency_benchmark";
+
+struct LatencyClientContext {
+  Histogram histogram;
+  esp_err_t error = ESP_OK;
+  SemaphoreHandle_t doneSemaphore;
+};
+
+//==============================================================================
+
+static esp_err_t RunClient(Histogram& histogram) {
+  PL::TcpClient client(ipV4Address, port);
+  ESP_RETURN_ON_ERROR(client.DisableNagleAlgorithm(), TAG, "Nagle's algorithm disable failed");
+  ESP_RETURN_ON_ERROR(client.Connect(), TAG, "client connect failed");
+  auto stream = client.GetStream();
+  std::vector<uint8_t> buffer(messageSize);
+
+  for (int i = 0; i < numberOfWarmUpRequests + CONFIG_BENCHMARK_LATENCY_NUMBER_OF_REQUESTS; i++) {
+    int64_t startTime = PL::GetTimeInMicroseconds();
+    ESP_RETURN_ON_ERROR(stream->Write(buffer.data(), buffer.size()), TAG, "request write failed");
+    ESP_RETURN_ON_ERROR(stream->Read(buffer.data(), buffer.size()), TAG, "response read failed");
+    if (i >= numberOfWarmUpRequests)
+      histogram.Add((uint32_t)std::min<int64_t>(PL::GetTimeInMicroseconds() - startTime, UINT32_MAX));
+  }
+  return client.Disconnect();
+}
+
+//==============================================================================
+
+static void ClientTaskCode(void* parameters) {
+  LatencyClientContext& context = *(LatencyClientContext*)parameters;
+  context.error = RunClient(context.histogram);
+  xSemaphoreGive(context.doneSemaphore);
+  vTaskDelete(NULL);
+}
+
+//==============================================================================
+
+bool RunLatencyBenchmark() {
+  LatencyServer server(port, messageSize);
+  ESP_ERROR_CHECK(server.SetMaxNumberOfClients(CONFIG_BENCHMARK_LATENCY_MAX_NUMBER_OF_CLIENTS));
+  ESP_ERROR_CHECK(server.Enable());
+  vTaskDelay(10);
+  SemaphoreHandle_t doneSemaphore = xSemaphoreCreateCounting(CONFIG_BENCHMARK_LATENCY_MAX_NUMBER_OF_CLIENTS, 0);
+  bool passed = true;
+
+  printf("{\"benchmark\":\"latency\",\"target\":\"%s\",\"messageSize\":%lu,\"results\":[", CONFIG_IDF_TARGET, (unsigned long)messageSize);
+  bool firstResult = true;
+  std::vector<int> numbersOfClients = {1};
+  for (int numberOfClients : {2, CONFIG_BENCHMARK_LATENCY_MAX_NUMBER_OF_CLIENTS}) {
+    if (numberOfClients > numbersOfClients.back() && numberOfClients <= CONFIG_BENCHMARK_LATENCY_MAX_NUMBER_OF_CLIENTS)
+      numbersOfClients.push_back(numberOfClients);
+  }
+  for (int numberOfClients : numbersOfClients) {
+    std::vector<LatencyClientContext> contexts(numberOfClients);
+    int numberOfStartedClients = 0;
+    for (auto& context : contexts) {
+      context.doneSemaphore = doneSemaphore;
+      if (xTaskCreate(ClientTaskCode, "latency_client", 4096, &context, tskIDLE_PRIORITY + 5, NULL) == pdPASS)
+        numberOfStartedClients++;
+      else
+        context.error = ESP_ERR_NO_MEM;
+    }
+    for (int i = 0; i < numberOfStartedClients; i++)
+      xSemaphoreTake(doneSemaphore, portMAX_DELAY);
+
+    Histogram histogram;
+    esp_err_t error = ESP_OK;
+    for (auto& context : contexts) {
+      histogram.Add(context.histogram);
+      if (context.error != ESP_OK)
+        error = context.error;
+    }
+
+    printf("%s\n{\"clients\":%d,", firstResult ? "" : ",", numberOfClients);
+    if (error == ESP_OK) {
+      uint32_t p99 = histogram.GetPercentile(99);
+      bool p99LimitExceeded = CONFIG_BENCHMARK_LATENCY_P99_LIMIT && p99 > CONFIG_BENCHMARK_LATENCY_P99_LIMIT;
+      printf("\"requests\":%llu,\"minUs\":%lu,\"meanUs\":%.1f,\"p50Us\":%lu,\"p99Us\":%lu,\"p99.9Us\":%lu,\"maxUs\":%lu,\"p99LimitExceeded\":%s}",
+        (unsigned long long)histogram.GetCount(), (unsigned long)histogram.GetMin(), histogram.GetMean(), (unsigned long)histogram.GetPercentile(50),
+        (unsigned long)p99, (unsigned long)histogram.GetPercentile(99.9), (unsigned long)histogram.GetMax(), p99LimitExceeded ? "true" : "false");
+      if (p99LimitExceeded)
+        passed = false;
+    }
+    else {
+      printf("\"error\":\"%s\"}", esp_err_to_name(error));
+      passed = false;
+    }
+    fflush(stdout);
+    firstResult = false;
+  }
+  printf("\n]}\n");
+
+  vSemaphoreDelete(doneSemaphore);
+  server.Disable();
+  return passed;
+}
+
+//==============================================================================
+
+LatencyServer::LatencyServer(uint16_t port, size_t messageSize) : TcpServer(port), buffer(messageSize) {
+  DisableNagleAlgorithm();
+}
+
+//==============================================================================
+
+esp_err_t LatencyServer::HandleRequest(PL::NetworkStream& clientStream) {
+  if (clientStream.GetReadableSize() < buffer.size())
+    return ESP_OK;
+  ESP_RETURN_ON_ERROR(clientStream.Read(buffer.data(), buffer.size()), TAG, "request read failed");
+  ESP_RETURN_ON_ERROR(clientStream.Write(buffer.data(), buffer.size()), TAG, "response write failed");
+  return ESP_OK;
+}
+
+#endif
\ No newline at end of file
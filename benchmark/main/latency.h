@@ -0,0 +1,21 @@
+#pragma once
+#include "pl_network.h"
+#include "histogram.h"
+
+//==============================================================================
+
+class LatencyServer : public PL::TcpServer {
+public:
+  LatencyServer(uint16_t port, size_t messageSize);
+
+protected:
+  esp_err_t HandleRequest(PL::NetworkStream& clientStream) override;
+
+private:
+  std::vector<uint8_t> buffer;
+};
+
+//==============================================================================
+
+// Returns false if the p99 latency limit is exceeded
+bool RunLatencyBenchmark();
\ No newline at end of file
@@ -0,0 +1,43 @@
+#include "throughput.h"
+#include "latency.h"
+#include "churn.h"
+#include "address.h"
+#if CONFIG_IDF_TARGET_LINUX
+#include <stdlib.h>
+#else
+#include "esp_event.h"
+#include "esp_netif.h"
+#endif
+
+//==============================================================================
+
+extern "C" void app_main(void) {
+  #if !CONFIG_IDF_TARGET_LINUX
+  ESP_ERROR_CHECK(esp_event_loop_create_default());
+  ESP_ERROR_CHECK(esp_netif_init());
+  #endif
+
+  bool passed = true;
+
+  #if CONFIG_BENCHMARK_ADDRESS
+  passed = RunAddressBenchmark() && passed;
+  #endif
+
+  #if CONFIG_BENCHMARK_THROUGHPUT
+  RunThroughputBenchmark();
+  #endif
+
+  #if CONFIG_BENCHMARK_LATENCY
+  passed = RunLatencyBenchmark() && passed;
+  #endif
+
+  #if CONFIG_BENCHMARK_CHURN
+  passed = RunChurnBenchmark() && passed;
+  #endif
+
+  printf("Benchmark %s\n", passed ? "passed" : "failed");
+
+  #if CONFIG_IDF_TARGET_LINUX
+  exit(passed ? 0 : 1);
+  #endif
+}
\ No newline at end of file
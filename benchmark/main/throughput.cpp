@@ -0,0 +1,118 @@
+#include "throughput.h"
+#include "esp_check.h"
+
+#if CONFIG_BENCHMARK_THROUGHPUT
+
+//==============================================================================
+
+const uint16_t port = 5001;
+const PL::IpV4Address ipV4Address(127, 0, 0, 1);
+const size_t chunkSizes[] = {1, 16, 256, 1024, 4096, 16384, 65536};
+const uint32_t readTimeoutsMs[] = {10, PL::NetworkStream::defaultReadTimeout * portTICK_PERIOD_MS};
+static const char* TAG = "throughput_benchmark";
+
+//==============================================================================
+
+static esp_err_t RunTest(ThroughputServer& server, ThroughputServer::Request& request, bool nagleAlgorithmEnabled, std::vector<uint8_t>& buffer, int64_t* time) {
+  ESP_RETURN_ON_ERROR(nagleAlgorithmEnabled ? server.EnableNagleAlgorithm() : server.DisableNagleAlgorithm(), TAG, "server Nagle's algorithm set failed");
+
+  PL::TcpClient client(ipV4Address, port);
+  ESP_RETURN_ON_ERROR(nagleAlgorithmEnabled ? client.EnableNagleAlgorithm() : client.DisableNagleAlgorithm(), TAG, "client Nagle's algorithm set failed");
+  ESP_RETURN_ON_ERROR(client.SetReadTimeout(std::max<TickType_t>(request.readTimeoutMs / portTICK_PERIOD_MS, 1)), TAG, "client read timeout set failed");
+  ESP_RETURN_ON_ERROR(client.Connect(), TAG, "client connect failed");
+  auto stream = client.GetStream();
+  ESP_RETURN_ON_ERROR(stream->Write(&request, sizeof(request)), TAG, "request write failed");
+
+  int64_t startTime = PL::GetTimeInMicroseconds();
+  for (size_t remainingSize = request.dataSize; remainingSize;) {
+    size_t size = std::min<size_t>(remainingSize, request.chunkSize);
+    esp_err_t error;
+    // Read timeouts are expected while the other side is waiting for a full Nagle segment
+    while ((error = request.direction == ThroughputServer::Direction::sink ? stream->Write(buffer.data(), size) : stream->Read(buffer.data(), size)) == ESP_ERR_TIMEOUT);
+    ESP_RETURN_ON_ERROR(error, TAG, "data transfer failed");
+    remainingSize -= size;
+  }
+  if (request.direction == ThroughputServer::Direction::sink) {
+    uint32_t receivedSize;
+    esp_err_t error;
+    while ((error = stream->Read(&receivedSize, sizeof(receivedSize))) == ESP_ERR_TIMEOUT);
+    ESP_RETURN_ON_ERROR(error, TAG, "acknowledgement read failed");
+    ESP_RETURN_ON_FALSE(receivedSize == request.dataSize, ESP_FAIL, TAG, "received size mismatch");
+  }
+  *time = PL::GetTimeInMicroseconds() - startTime;
+  return client.Disconnect();
+}
+
+//==============================================================================
+
+void RunThroughputBenchmark() {
+  ThroughputServer server(port);
+  ESP_ERROR_CHECK(server.Enable());
+  vTaskDelay(10);
+  std::vector<uint8_t> buffer(ThroughputServer::bufferSize);
+
+  printf("{\"benchmark\":\"throughput\",\"target\":\"%s\",\"results\":[", CONFIG_IDF_TARGET);
+  bool firstResult = true;
+  for (auto direction : {ThroughputServer::Direction::sink, ThroughputServer::Direction::source}) {
+    for (auto bufferMode : {ThroughputServer::BufferMode::chunk, ThroughputServer::BufferMode::readable}) {
+      // Buffer mode only changes the server read operations
+      if (direction == ThroughputServer::Direction::source && bufferMode != ThroughputServer::BufferMode::chunk)
+        continue;
+      for (bool nagleAlgorithmEnabled : {true, false}) {
+        for (uint32_t readTimeoutMs : readTimeoutsMs) {
+          for (size_t chunkSize : chunkSizes) {
+            ThroughputServer::Request request = {direction, bufferMode,
+              (uint32_t)std::min<size_t>(CONFIG_BENCHMARK_THROUGHPUT_DATA_SIZE, chunkSize * CONFIG_BENCHMARK_THROUGHPUT_MAX_NUMBER_OF_WRITES),
+              (uint32_t)chunkSize, readTimeoutMs};
+            int64_t time = 0;
+            esp_err_t error = RunTest(server, request, nagleAlgorithmEnabled, buffer, &time);
+            printf("%s\n{\"direction\":\"%s\",\"bufferMode\":\"%s\",\"nagle\":%s,\"readTimeoutMs\":%lu,\"chunkSize\":%lu,\"dataSize\":%lu,",
+              firstResult ? "" : ",", direction == ThroughputServer::Direction::sink ? "sink" : "source",
+              bufferMode == ThroughputServer::BufferMode::chunk ? "chunk" : "readable", nagleAlgorithmEnabled ? "true" : "false",
+              (unsigned long)readTimeoutMs, (unsigned long)chunkSize, (unsigned long)request.dataSize);
+            if (error == ESP_OK)
+              printf("\"timeUs\":%lld,\"megabytesPerSecond\":%.3f}", (long long)time, time ? (double)request.dataSize / time : 0.0);
+            else
+              printf("\"error\":\"%s\"}", esp_err_to_name(error));
+            fflush(stdout);
+            firstResult = false;
+            vTaskDelay(1);
+          }
+        }
+      }
+    }
+  }
+  printf("\n]}\n");
+
+  server.Disable();
+}
+
+//==============================================================================
+
+ThroughputServer::ThroughputServer(uint16_t port) : TcpServer(port), buffer(bufferSize) {}
+
+//==============================================================================
+
+esp_err_t ThroughputServer::HandleRequest(PL::NetworkStream& clientStream) {
+  Request request;
+  if (clientStream.GetReadableSize() < sizeof(request))
+    return ESP_OK;
+  ESP_RETURN_ON_ERROR(clientStream.Read(&request, sizeof(request)), TAG, "request read failed");
+  ESP_RETURN_ON_ERROR(clientStream.SetReadTimeout(std::max<TickType_t>(request.readTimeoutMs / portTICK_PERIOD_MS, 1)), TAG, "read timeout set failed");
+
+  for (size_t remainingSize = request.dataSize; remainingSize;) {
+    size_t size = std::min<size_t>(remainingSize, request.chunkSize);
+    if (request.direction == Direction::sink && request.bufferMode == BufferMode::readable)
+      size = std::min(std::min(remainingSize, buffer.size()), std::max<size_t>(clientStream.GetReadableSize(), 1));
+    esp_err_t error;
+    while ((error = request.direction == Direction::sink ? clientStream.Read(buffer.data(), size) : clientStream.Write(buffer.data(), size)) == ESP_ERR_TIMEOUT);
+    ESP_RETURN_ON_ERROR(error, TAG, "data transfer failed");
+    remainingSize -= size;
+  }
+
+  if (request.direction == Direction::sink)
+    ESP_RETURN_ON_ERROR(clientStream.Write(&request.dataSize, sizeof(request.dataSize)), TAG, "acknowledgement write failed");
+  return ESP_OK;
+}
+
+#endif
\ No newline at end of file
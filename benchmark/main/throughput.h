@@ -0,0 +1,41 @@
+#pragma once
+#include "pl_network.h"
+
+//==============================================================================
+
+class ThroughputServer : public PL::TcpServer {
+public:
+  enum class Direction : uint32_t {
+    sink,
+    source
+  };
+
+  enum class BufferMode : uint32_t {
+    // Read exactly the chunk size
+    chunk,
+    // Read the readable size (up to the buffer size)
+    readable
+  };
+
+  struct Request {
+    Direction direction;
+    BufferMode bufferMode;
+    uint32_t dataSize;
+    uint32_t chunkSize;
+    uint32_t readTimeoutMs;
+  };
+
+  static const size_t bufferSize = 65536;
+
+  ThroughputServer(uint16_t port);
+
+protected:
+  esp_err_t HandleRequest(PL::NetworkStream& clientStream) override;
+
+private:
+  std::vector<uint8_t> buffer;
+};
+
+//==============================================================================
+
+void RunThroughputBenchmark();
\ No newline at end of file
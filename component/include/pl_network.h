@@ -1,12 +1,20 @@
 #pragma once
 #include "pl_network_types.h"
+#include "pl_socket_profile.h"
 #include "pl_network_stream.h"
+#include "pl_network_stream_pool.h"
 #include "pl_network_interface.h"
 #include "pl_ethernet.h"
 #include "pl_wifi_station.h"
+#if !CONFIG_IDF_TARGET_LINUX
 #include "pl_esp_network_interface.h"
 #include "pl_esp_wifi_station.h"
 #include "pl_esp_ethernet.h"
+#endif
 #include "pl_network_server.h"
 #include "pl_tcp_client.h"
-#include "pl_tcp_server.h"
\ No newline at end of file
+#include "pl_tcp_server.h"
+#include "pl_tcp_server_host.h"
+#include "pl_token_bucket.h"
+#include "pl_network_buffer_allocator.h"
+#include "pl_network_trace.h"
\ No newline at end of file
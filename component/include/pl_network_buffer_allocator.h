@@ -0,0 +1,137 @@
+#pragma once
+#include "pl_common.h"
+#include "pl_network_platform.h"
+#include <memory>
+#include <new>
+#include <utility>
+
+//==============================================================================
+
+namespace PL {
+
+//==============================================================================
+
+/// @brief Network buffer allocator with the selected memory capabilities (e.g. PSRAM for the bulk buffers and internal RAM for the small hot ones).
+/// Freed buffers are kept in the size class free lists and are reused by the next allocations of the same size class.
+class NetworkBufferAllocator : public Lockable {
+public:
+  /// @brief Smallest size class in bytes (each next size class is twice as large)
+  static const size_t minSizeClass = 64;
+  /// @brief Number of size classes. Larger buffers are allocated and freed directly.
+  static const size_t numberOfSizeClasses = 8;
+  /// @brief Default maximum number of free buffers kept in each size class free list
+  static const size_t defaultMaxNumberOfFreeBuffers = 4;
+
+  /// @brief Creates a network buffer allocator
+  /// @param caps memory capabilities (MALLOC_CAP_..., ignored on the linux target)
+  /// @param fallbackCaps memory capabilities used when the allocation with caps fails (0 - no fallback)
+  /// @param maxNumberOfFreeBuffers maximum number of free buffers kept in each size class free list
+  NetworkBufferAllocator(uint32_t caps, uint32_t fallbackCaps = 0, size_t maxNumberOfFreeBuffers = defaultMaxNumberOfFreeBuffers);
+  ~NetworkBufferAllocator();
+  NetworkBufferAllocator(const NetworkBufferAllocator&) = delete;
+  NetworkBufferAllocator& operator=(const NetworkBufferAllocator&) = delete;
+
+  esp_err_t Lock(TickType_t timeout = portMAX_DELAY) override;
+  esp_err_t Unlock() override;
+
+  /// @brief Allocates a buffer
+  /// @param size buffer size
+  /// @return buffer (null if out of memory)
+  void* Allocate(size_t size);
+
+  /// @brief Frees the buffer
+  /// @param buffer buffer (null is ignored)
+  /// @param size buffer size passed to Allocate
+  void Free(void* buffer, size_t size);
+
+  /// @brief Releases the buffers of the free lists to the heap
+  void Trim();
+
+  /// @brief Gets the number of buffers in the free lists
+  /// @return number of buffers
+  size_t GetNumberOfFreeBuffers();
+
+  /// @brief Gets the default allocator (internal RAM) that is used when no allocator is set
+  /// @return allocator
+  static std::shared_ptr<NetworkBufferAllocator> GetDefault();
+
+private:
+  struct FreeBuffer {
+    FreeBuffer* next;
+  };
+
+  Mutex mutex;
+  uint32_t caps, fallbackCaps;
+  size_t maxNumberOfFreeBuffers;
+  FreeBuffer* freeLists[numberOfSizeClasses] = {};
+  size_t numberOfFreeBuffers[numberOfSizeClasses] = {};
+
+  static size_t GetSizeClassIndex(size_t size);
+  void* AllocateFromHeap(size_t size);
+  static void FreeToHeap(void* buffer);
+};
+
+//==============================================================================
+
+/// @brief Fixed-size array of objects in a buffer of a network buffer allocator
+/// @tparam T element type
+template <class T>
+class NetworkBufferArray {
+public:
+  /// @brief Creates an empty array
+  NetworkBufferArray() {}
+  ~NetworkBufferArray() { Free(); }
+  NetworkBufferArray(const NetworkBufferArray&) = delete;
+  NetworkBufferArray& operator=(const NetworkBufferArray&) = delete;
+
+  /// @brief Allocates the array of the default constructed elements. The previous elements are destroyed.
+  /// @param allocator allocator
+  /// @param size number of elements
+  /// @return error code
+  esp_err_t Allocate(std::shared_ptr<NetworkBufferAllocator> allocator, size_t size) {
+    Free();
+    if (!size)
+      return ESP_OK;
+    if (!(elements = (T*)allocator->Allocate(size * sizeof(T))))
+      return ESP_ERR_NO_MEM;
+    for (size_t i = 0; i < size; i++)
+      new (&elements[i]) T();
+    this->allocator = allocator;
+    this->size = size;
+    return ESP_OK;
+  }
+
+  /// @brief Destroys the elements and frees the buffer
+  void Free() {
+    for (size_t i = 0; i < size; i++)
+      elements[i].~T();
+    if (elements)
+      allocator->Free(elements, size * sizeof(T));
+    elements = NULL;
+    allocator = nullptr;
+    size = 0;
+  }
+
+  /// @brief Exchanges the contents with the other array
+  /// @param other other array
+  void Swap(NetworkBufferArray& other) {
+    std::swap(allocator, other.allocator);
+    std::swap(elements, other.elements);
+    std::swap(size, other.size);
+  }
+
+  /// @brief Gets the number of elements
+  /// @return number of elements
+  size_t GetSize() const { return size; }
+
+  T& operator[](size_t index) { return elements[index]; }
+
+private:
+  std::shared_ptr<NetworkBufferAllocator> allocator;
+  T* elements = NULL;
+  size_t size = 0;
+};
+
+//==============================================================================
+
+}
\ No newline at end of file
@@ -0,0 +1,95 @@
+#pragma once
+#include "sdkconfig.h"
+#include "stdint.h"
+
+#if CONFIG_IDF_TARGET_LINUX
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <sys/ioctl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#else
+#include "lwip/sockets.h"
+#include "esp_timer.h"
+#include "esp_heap_caps.h"
+#endif
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+//==============================================================================
+
+namespace PL {
+
+//==============================================================================
+
+/// @brief Gets the monotonic time (esp_timer on ESP targets, CLOCK_MONOTONIC on the linux target)
+/// @return time in microseconds
+inline int64_t GetTimeInMicroseconds() {
+#if CONFIG_IDF_TARGET_LINUX
+  timespec time;
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return (int64_t)time.tv_sec * 1000000 + time.tv_nsec / 1000;
+#else
+  return esp_timer_get_time();
+#endif
+}
+
+//==============================================================================
+
+/// @brief Gets the free internal heap size (not limited on the linux target)
+/// @return size in bytes
+inline size_t GetFreeHeapSize() {
+#if CONFIG_IDF_TARGET_LINUX
+  return SIZE_MAX;
+#else
+  return heap_caps_get_free_size(MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+#endif
+}
+
+//==============================================================================
+
+/// @brief Opens a UDP socket that is connected to itself on the loopback interface.
+/// A select call that waits for the socket returns when a datagram is sent to it (SendWake).
+/// @return socket (-1 if the loopback interface is not available)
+inline int OpenWakeSocket() {
+  int sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+  if (sock < 0)
+    return -1;
+  sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  socklen_t addrLen = sizeof(addr);
+  if (bind(sock, (sockaddr*)&addr, sizeof(addr)) || getsockname(sock, (sockaddr*)&addr, &addrLen) || connect(sock, (sockaddr*)&addr, sizeof(addr))) {
+    close(sock);
+    return -1;
+  }
+  return sock;
+}
+
+//==============================================================================
+
+/// @brief Wakes the select call that waits for the wake socket
+/// @param sock wake socket
+inline void SendWake(int sock) {
+  uint8_t data = 0;
+  send(sock, &data, sizeof(data), MSG_DONTWAIT);
+}
+
+//==============================================================================
+
+/// @brief Receives the pending wake datagrams of the wake socket
+/// @param sock wake socket
+inline void ReceiveWakes(int sock) {
+  uint8_t data;
+  while (recv(sock, &data, sizeof(data), MSG_DONTWAIT) > 0);
+}
+
+//==============================================================================
+
+}
\ No newline at end of file
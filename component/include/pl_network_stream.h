@@ -1,7 +1,11 @@
 #pragma once
 #include "pl_common.h"
 #include "pl_network_types.h"
-#include "lwip/sockets.h"
+#include "pl_token_bucket.h"
+#include "pl_network_buffer_allocator.h"
+#include "pl_socket_profile.h"
+#include "pl_network_platform.h"
+#include <atomic>
 
 //==============================================================================
 
@@ -9,11 +13,49 @@ namespace PL {
 
 //==============================================================================
 
+/// @brief Network stream close reason
+enum class NetworkStreamCloseReason {
+  /// @brief stream is open or has never been opened
+  none,
+  /// @brief stream is closed locally
+  local,
+  /// @brief stream is closed by the remote side
+  remote,
+  /// @brief stream is closed after a read or write error
+  error
+};
+
+//==============================================================================
+
+/// @brief Network stream statistics
+struct NetworkStreamStatistics {
+  /// @brief Number of bytes read (wraps around at 4 GiB, so that the counter is a lock-free atomic on the 32-bit targets)
+  uint32_t numberOfBytesRead;
+  /// @brief Number of bytes written (wraps around at 4 GiB)
+  uint32_t numberOfBytesWritten;
+  /// @brief Number of socket receive calls
+  uint32_t numberOfReceiveCalls;
+  /// @brief Number of socket send calls
+  uint32_t numberOfSendCalls;
+  /// @brief Number of read operations that timed out
+  uint32_t numberOfReadTimeouts;
+  /// @brief Number of socket send calls that sent less data than requested
+  uint32_t numberOfShortSends;
+  /// @brief Close reason
+  NetworkStreamCloseReason closeReason;
+};
+
+//==============================================================================
+
 /// @brief Network stream class
 class NetworkStream : public Stream {
 public:
   /// @brief Default read operation timeout in FreeRTOS ticks
   static const TickType_t defaultReadTimeout = 300 / portTICK_PERIOD_MS;
+  /// @brief Default request handling budget weight
+  static const uint32_t defaultWeight = 1;
+  /// @brief Size of the buffer used to discard the read data (allocated by the stream buffer allocator on the first discard and freed on close)
+  static const size_t discardBufferSize = 512;
 
   /// @brief Creates a closed network stream
   NetworkStream() {}
@@ -30,6 +72,11 @@ public:
   using Stream::Write;
   esp_err_t Write(const void* src, size_t size) override;
 
+  /// @brief Opens the closed stream with a new socket and resets the stream settings and statistics (allows reusing the stream object)
+  /// @param sock stream socket
+  /// @return error code
+  esp_err_t Open(int sock);
+
   /// @brief Closes the stream
   /// @return error code
   esp_err_t Close();
@@ -56,6 +103,13 @@ public:
 
   size_t GetReadableSize() override;
 
+  /// @brief Blocks until the stream has data to read, is closed by the remote side or the timeout expires.
+  /// The stream is not locked while waiting.
+  /// @param timeout timeout in FreeRTOS ticks
+  /// The data can still be hidden by GetReadableSize while the request handling budget or the shared rate limits are exhausted.
+  /// @return error code (ESP_ERR_TIMEOUT - no data, ESP_ERR_INVALID_STATE - stream is closed)
+  esp_err_t WaitForData(TickType_t timeout = portMAX_DELAY);
+
   TickType_t GetReadTimeout() override;
   esp_err_t SetReadTimeout(TickType_t timeout) override;
 
@@ -82,13 +136,101 @@ public:
   /// @return error code
   esp_err_t SetKeepAliveCount(int count);
 
+  /// @brief Applies the socket profile to the stream socket. Options that are not set in the profile are not changed.
+  /// @param profile socket profile
+  /// @return error code
+  esp_err_t SetSocketProfile(const SocketProfile& profile);
+
+  /// @brief Sets the read data rate limit of the stream. Read operations are paced to the specified rate.
+  /// @param bytesPerSecond rate in bytes per second (0 - no limit)
+  /// @param burst number of bytes that can be read without pacing
+  /// @return error code
+  esp_err_t SetReadRateLimit(uint32_t bytesPerSecond, uint32_t burst);
+
+  /// @brief Sets the write data rate limit of the stream. Write operations are paced to the specified rate.
+  /// @param bytesPerSecond rate in bytes per second (0 - no limit)
+  /// @param burst number of bytes that can be written without pacing
+  /// @return error code
+  esp_err_t SetWriteRateLimit(uint32_t bytesPerSecond, uint32_t burst);
+
+  /// @brief Sets the token bucket that limits the total read data rate of several streams.
+  /// Read operations do not wait for the shared bucket: they take its tokens in advance and GetReadableSize returns 0 while it is empty.
+  /// @param tokenBucket shared token bucket (null - no limit, ignored if the stream is exempt from the shared rate limits)
+  /// @return error code
+  esp_err_t SetSharedReadTokenBucket(std::shared_ptr<SharedTokenBucket> tokenBucket);
+
+  /// @brief Sets the token bucket that limits the total write data rate of several streams.
+  /// Write operations do not wait for the shared bucket: they take its tokens in advance and GetReadableSize returns 0 while it is empty.
+  /// @param tokenBucket shared token bucket (null - no limit, ignored if the stream is exempt from the shared rate limits)
+  /// @return error code
+  esp_err_t SetSharedWriteTokenBucket(std::shared_ptr<SharedTokenBucket> tokenBucket);
+
+  /// @brief Checks if the stream is exempt from the shared rate limits
+  /// @return true if the stream is exempt
+  bool IsSharedRateLimitExempt();
+
+  /// @brief Exempts the stream from the shared rate limits (e.g. a control connection of the server with the aggregate rate limits).
+  /// The shared token buckets are detached. The exemption is reset when the stream is opened.
+  /// @param exempt true - exempt, false - not exempt
+  /// @return error code
+  esp_err_t SetSharedRateLimitExempt(bool exempt);
+
+  /// @brief Gets the allocator of the stream buffers (e.g. the buffers of the request handler)
+  /// @return allocator (default allocator if no allocator is set)
+  std::shared_ptr<NetworkBufferAllocator> GetBufferAllocator();
+
+  /// @brief Sets the allocator of the stream buffers
+  /// @param allocator allocator (null - default allocator)
+  /// @return error code
+  esp_err_t SetBufferAllocator(std::shared_ptr<NetworkBufferAllocator> allocator);
+
+  /// @brief Gets the request handling budget weight
+  /// @return weight
+  uint32_t GetWeight();
+
+  /// @brief Sets the request handling budget weight. The server request handling budget of the stream is multiplied by the weight.
+  /// @param weight weight
+  /// @return error code
+  esp_err_t SetWeight(uint32_t weight);
+
+  /// @brief Converts the socket address to the network endpoint
+  /// @param sockAddr socket address (IPv4-mapped IPv6 addresses are converted to IPv4)
+  /// @return network endpoint
+  static NetworkEndpoint SockAddrToEndpoint(const sockaddr_storage& sockAddr);
+
+  /// @brief Gets the stream statistics. The method does not lock the stream.
+  /// @return statistics
+  NetworkStreamStatistics GetStatistics();
+
 private:
+  friend class TcpServer;
+
   Mutex mutex;
   int sock = -1;
   TickType_t readTimeout = defaultReadTimeout;
-
-  NetworkEndpoint SockAddrToEndpoint(sockaddr_storage& sockAddr);
+  TokenBucket readTokenBucket;
+  TokenBucket writeTokenBucket;
+  std::shared_ptr<SharedTokenBucket> sharedReadTokenBucket;
+  std::shared_ptr<SharedTokenBucket> sharedWriteTokenBucket;
+  bool sharedRateLimitExempt = false;
+  std::shared_ptr<NetworkBufferAllocator> bufferAllocator;
+  NetworkBufferArray<uint8_t> discardBuffer;
+  std::atomic<uint32_t> numberOfBytesRead = {0};
+  std::atomic<uint32_t> numberOfBytesWritten = {0};
+  std::atomic<uint32_t> numberOfReceiveCalls = {0};
+  std::atomic<uint32_t> numberOfSendCalls = {0};
+  std::atomic<uint32_t> numberOfReadTimeouts = {0};
+  std::atomic<uint32_t> numberOfShortSends = {0};
+  std::atomic<NetworkStreamCloseReason> closeReason = {NetworkStreamCloseReason::none};
+  uint32_t weight = defaultWeight;
+  size_t readBudget = SIZE_MAX;
+  int64_t readBudgetDeadline = 0;
+
+  esp_err_t Close(NetworkStreamCloseReason reason);
   esp_err_t SetSocketOption(int level, int option, int value);
+  static size_t WaitForTokens(TokenBucket& tokenBucket, size_t size);
+  int64_t GetSharedTokenRefillTime();
+  static void TakeTokens(TokenBucket& tokenBucket, SharedTokenBucket* sharedTokenBucket, size_t size);
 };
   
 //==============================================================================
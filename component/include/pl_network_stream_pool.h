@@ -0,0 +1,56 @@
+#pragma once
+#include "pl_network_stream.h"
+#include <vector>
+
+//==============================================================================
+
+namespace PL {
+
+//==============================================================================
+
+/// @brief Fixed-size pool of preconstructed network streams that are reused for new connections
+class NetworkStreamPool : public Lockable {
+public:
+  /// @brief Creates a network stream pool
+  /// @param size number of streams
+  NetworkStreamPool(size_t size);
+
+  esp_err_t Lock(TickType_t timeout = portMAX_DELAY) override;
+  esp_err_t Unlock() override;
+
+  /// @brief Opens a free stream of the pool with the socket.
+  /// A stream is free if it is closed and is not referenced outside the pool.
+  /// @param sock stream socket
+  /// @return stream (null if there are no free streams)
+  std::shared_ptr<NetworkStream> Open(int sock);
+
+  /// @brief Gets the number of streams
+  /// @return number of streams
+  size_t GetSize();
+
+  /// @brief Sets the number of streams. When the pool is shrunk, the free streams are removed first.
+  /// Streams that are in use remain valid until they are released.
+  /// @param size number of streams
+  /// @return error code
+  esp_err_t SetSize(size_t size);
+
+  /// @brief Replaces the pool streams with the externally allocated (e.g. static) streams that are not deleted by the pool
+  /// @param streams streams
+  /// @param size number of streams
+  /// @return error code
+  esp_err_t SetStreams(NetworkStream* streams, size_t size);
+
+  /// @brief Gets the number of free streams
+  /// @return number of streams
+  size_t GetNumberOfFreeStreams();
+
+private:
+  Mutex mutex;
+  std::vector<std::shared_ptr<NetworkStream>> streams;
+
+  static bool IsFree(const std::shared_ptr<NetworkStream>& stream);
+};
+
+//==============================================================================
+
+}
\ No newline at end of file
@@ -0,0 +1,126 @@
+#pragma once
+#include "sdkconfig.h"
+#include "stdint.h"
+#include <stdio.h>
+
+//==============================================================================
+
+#if CONFIG_PL_NETWORK_TRACE
+/// @brief Adds the trace record (only the value is evaluated if the trace is disabled in the project configuration)
+#define PL_NETWORK_TRACE(event, object, value) PL::NetworkTrace::Add(PL::NetworkTraceEvent::event, object, value)
+/// @brief Adds the begin trace record and the end trace record when the scope is left (value is read at the scope end)
+#define PL_NETWORK_TRACE_SCOPE(beginEvent, endEvent, object, beginValue, endValue) \
+  PL::NetworkTraceScope networkTraceScope(PL::NetworkTraceEvent::beginEvent, PL::NetworkTraceEvent::endEvent, object, beginValue, endValue)
+#else
+#define PL_NETWORK_TRACE(event, object, value) ((void)(value))
+#define PL_NETWORK_TRACE_SCOPE(beginEvent, endEvent, object, beginValue, endValue)
+#endif
+
+//==============================================================================
+
+namespace PL {
+
+//==============================================================================
+
+/// @brief Network trace event
+enum class NetworkTraceEvent : uint8_t {
+  /// @brief TCP server accepted a connection (value: socket)
+  accept,
+  /// @brief TCP server found a client stream with incoming data (value: readable size)
+  readable,
+  /// @brief TCP server HandleRequest begin
+  handleRequestBegin,
+  /// @brief TCP server HandleRequest end (value: error code)
+  handleRequestEnd,
+  /// @brief Network stream Read begin (value: requested size)
+  readBegin,
+  /// @brief Network stream Read end (value: read size)
+  readEnd,
+  /// @brief Network stream Write begin (value: requested size)
+  writeBegin,
+  /// @brief Network stream Write end (value: written size)
+  writeEnd,
+  /// @brief Network stream lock acquired
+  streamLockAcquired,
+  /// @brief Network stream lock released
+  streamLockReleased,
+  /// @brief TCP server lock acquired
+  serverLockAcquired,
+  /// @brief TCP server lock released
+  serverLockReleased
+};
+
+//==============================================================================
+
+#if CONFIG_PL_NETWORK_TRACE
+
+/// @brief Network trace record
+struct NetworkTraceRecord {
+  /// @brief Time in microseconds
+  int64_t time;
+  /// @brief Task handle
+  void* task;
+  /// @brief Traced object (stream or server)
+  const void* object;
+  /// @brief Event value
+  uint32_t value;
+  /// @brief Event
+  NetworkTraceEvent event;
+};
+
+//==============================================================================
+
+/// @brief Network trace class. Records are stored in a lock-free ring buffer for each core.
+class NetworkTrace {
+public:
+  /// @brief Number of records in the ring buffer of each core
+  static const size_t bufferSize = CONFIG_PL_NETWORK_TRACE_BUFFER_SIZE;
+
+  /// @brief Adds the trace record to the ring buffer of the current core
+  /// @param event event
+  /// @param object traced object
+  /// @param value event value
+  static void Add(NetworkTraceEvent event, const void* object, uint32_t value);
+
+  /// @brief Removes all records
+  static void Clear();
+
+  /// @brief Writes the records in Chrome trace event JSON format (Perfetto, chrome://tracing).
+  /// Records that are being added during the dump can be inconsistent.
+  /// @param file file (e.g. stdout)
+  /// @return number of written records
+  static size_t Dump(FILE* file);
+};
+
+//==============================================================================
+
+/// @brief Network trace scope class (adds the end record in the destructor)
+class NetworkTraceScope {
+public:
+  /// @brief Adds the begin trace record
+  /// @param beginEvent begin event
+  /// @param endEvent end event
+  /// @param object traced object
+  /// @param beginValue begin event value
+  /// @param endValue reference to the end event value
+  NetworkTraceScope(NetworkTraceEvent beginEvent, NetworkTraceEvent endEvent, const void* object, uint32_t beginValue, const size_t& endValue) :
+      endEvent(endEvent), object(object), endValue(endValue) {
+    NetworkTrace::Add(beginEvent, object, beginValue);
+  }
+  ~NetworkTraceScope() {
+    NetworkTrace::Add(endEvent, object, endValue);
+  }
+  NetworkTraceScope(const NetworkTraceScope&) = delete;
+  NetworkTraceScope& operator=(const NetworkTraceScope&) = delete;
+
+private:
+  NetworkTraceEvent endEvent;
+  const void* object;
+  const size_t& endValue;
+};
+
+#endif
+
+//==============================================================================
+
+}
\ No newline at end of file
@@ -82,7 +82,7 @@ struct IpV6Address {
   /// @brief Creates an IPv6 address from dwords in network byte order
   IpV6Address(uint32_t u32_0, uint32_t u32_1, uint32_t u32_2, uint32_t u32_3, uint8_t zoneId = 0);
 
-  /// @brief Creates an IPv6 address from string
+  /// @brief Creates an IPv6 address from string (with an optional numeric "%zoneId" suffix)
   IpV6Address(const std::string& address);
 
   /// @brief Converts address to string
@@ -117,6 +117,9 @@ struct NetworkAddress {
   /// @brief Converts address to string
   /// @return address as string
   std::string ToString() const;
+
+  bool operator==(const NetworkAddress& address) const;
+  bool operator!=(const NetworkAddress& address) const;
 };
 
 //==============================================================================
@@ -138,4 +141,26 @@ struct NetworkEndpoint {
 
 //==============================================================================
 
+/// @brief Network address prefix (address and prefix length)
+struct NetworkAddressPrefix {
+  /// @brief Address
+  NetworkAddress address;
+  /// @brief Prefix length in bits
+  uint8_t length;
+
+  /// @brief Creates a zero-length prefix of unknown family
+  NetworkAddressPrefix();
+  /// @brief Creates an IPv4 address prefix
+  NetworkAddressPrefix(IpV4Address address, uint8_t length);
+  /// @brief Creates an IPv6 address prefix
+  NetworkAddressPrefix(IpV6Address address, uint8_t length);
+
+  /// @brief Checks if the address matches the prefix
+  /// @param address address
+  /// @return true if the address family is the same and the first prefix length bits of the address are equal
+  bool Contains(const NetworkAddress& address) const;
+};
+
+//==============================================================================
+
 }
\ No newline at end of file
@@ -0,0 +1,59 @@
+#pragma once
+#include "pl_common.h"
+#include "stdint.h"
+
+//==============================================================================
+
+namespace PL {
+
+//==============================================================================
+
+/// @brief Stream socket options that are applied to a socket at once
+struct SocketProfile {
+  /// @brief Maximum DSCP value
+  static const int maxDscp = 63;
+  /// @brief Default idle time before the keep-alive packets are sent in seconds
+  static const int defaultKeepAliveIdleTime = 7200;
+  /// @brief Default keep-alive packet interval in seconds
+  static const int defaultKeepAliveInterval = 75;
+  /// @brief Default number of the keep-alive packets
+  static const int defaultKeepAliveCount = 9;
+
+  /// @brief Nagle's algorithm is enabled (TCP_NODELAY is not set)
+  bool nagleAlgorithmEnabled = true;
+  /// @brief Keep-alive packets are enabled
+  bool keepAliveEnabled = false;
+  /// @brief Idle time before the keep-alive packets are sent in seconds
+  int keepAliveIdleTime = defaultKeepAliveIdleTime;
+  /// @brief Keep-alive packet interval in seconds
+  int keepAliveInterval = defaultKeepAliveInterval;
+  /// @brief Number of the keep-alive packets
+  int keepAliveCount = defaultKeepAliveCount;
+  /// @brief DSCP value of the outgoing packets (-1 - not set)
+  int dscp = -1;
+  /// @brief Socket receive buffer size in bytes (0 - not set). Requires CONFIG_LWIP_SO_RCVBUF on ESP targets.
+  int receiveBufferSize = 0;
+  /// @brief Socket send buffer size in bytes (0 - not set). Not supported by lwIP.
+  int sendBufferSize = 0;
+  /// @brief Time to wait for the unsent data on close in seconds (0 - connection is reset on close, -1 - not set).
+  /// Requires CONFIG_LWIP_SO_LINGER on ESP targets.
+  int lingerTime = -1;
+
+  /// @brief Creates a profile for the low-latency control traffic: Nagle's algorithm is disabled, packets are marked with
+  /// the Expedited Forwarding DSCP and the broken connections are detected by the keep-alive packets within a minute
+  /// @return socket profile
+  static SocketProfile Control();
+
+  /// @brief Creates a profile for the bulk data traffic: Nagle's algorithm is enabled and packets are marked with the low-priority DSCP
+  /// @return socket profile
+  static SocketProfile Bulk();
+
+  /// @brief Checks that the profile values are valid and the options are supported by the platform
+  /// @param profile socket profile
+  /// @return error code
+  static esp_err_t Validate(const SocketProfile& profile);
+};
+
+//==============================================================================
+
+}
\ No newline at end of file
@@ -42,6 +42,15 @@ public:
   /// @return error code
   esp_err_t DisableNagleAlgorithm();
 
+  /// @brief Gets the socket profile that is applied to the stream on connection
+  /// @return socket profile
+  SocketProfile GetSocketProfile();
+
+  /// @brief Sets the socket profile that is applied to the stream on connection (and to the connected stream)
+  /// @param profile socket profile
+  /// @return error code
+  esp_err_t SetSocketProfile(const SocketProfile& profile);
+
   /// @brief Checks if the client is connected
   /// @return true if the client is connected
   bool IsConnected();
@@ -84,7 +93,7 @@ private:
   NetworkEndpoint remoteEndpoint;
   std::shared_ptr<NetworkStream> stream;
   TickType_t readTimeout = NetworkStream::defaultReadTimeout;
-  bool nagleAlgorithmEnabled = true;
+  SocketProfile socketProfile;
 };
 
 //==============================================================================
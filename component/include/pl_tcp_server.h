@@ -1,6 +1,9 @@
 #pragma once
 #include "pl_network_stream.h"
+#include "pl_network_stream_pool.h"
 #include "pl_network_server.h"
+#include "pl_token_bucket.h"
+#include "freertos/semphr.h"
 
 //==============================================================================
 
@@ -8,19 +11,74 @@ namespace PL {
 
 //==============================================================================
 
+/// @brief TCP server statistics
+struct TcpServerStatistics {
+  /// @brief Number of HandleRequest duration histogram bins
+  static const size_t handleRequestDurationHistogramSize = 12;
+  /// @brief Upper limit of the first HandleRequest duration histogram bin in microseconds (each next bin limit is twice as large)
+  static const uint32_t handleRequestDurationHistogramResolution = 100;
+
+  /// @brief Number of accepted connections (including the rejected ones)
+  uint32_t numberOfAcceptedConnections;
+  /// @brief Number of connections rejected by the client access rules
+  uint32_t numberOfDeniedConnections;
+  /// @brief Number of connections rejected by the connection rate limiters
+  uint32_t numberOfRateLimitedConnections;
+  /// @brief Number of connections rejected by the memory budget
+  uint32_t numberOfMemoryLimitedConnections;
+  /// @brief Number of client disconnections by close reason
+  uint32_t numberOfDisconnections[(int)NetworkStreamCloseReason::error + 1];
+  /// @brief Number of HandleRequest calls
+  uint32_t numberOfHandledRequests;
+  /// @brief HandleRequest duration histogram (the last bin counts all requests that are longer than the previous bin limit)
+  uint32_t handleRequestDurationHistogram[handleRequestDurationHistogramSize];
+};
+
+//==============================================================================
+
+class TcpServerHost;
+
+//==============================================================================
+
+/// @brief TCP server client event dispatch mode
+enum class TcpServerEventDispatchMode {
+  /// @brief client events are generated by the server task while the server is locked
+  immediate,
+  /// @brief client events are generated by the server task at the end of the loop iteration while the server is not locked
+  endOfIteration,
+  /// @brief client events are passed through a lock-free queue to a separate dispatcher task
+  dispatcherTask
+};
+
+//==============================================================================
+
 /// @brief TCP server class
 class TcpServer : public NetworkServer {
 public:
   /// @brief Default server task parameters
   static const TaskParameters defaultTaskParameters;
+  /// @brief Default client event dispatcher task parameters
+  static const TaskParameters defaultEventDispatcherTaskParameters;
+  /// @brief Default client event queue size of the dispatcher task mode
+  static const size_t defaultEventQueueSize = 16;
   /// @brief Default maximum number of server clients
   static const int defaultMaxNumberOfClients = 1;
   /// @brief Default idle time before the keep-alive packets are sent in seconds
-  static const int defaultKeepAliveIdleTime = 7200;
+  static const int defaultKeepAliveIdleTime = SocketProfile::defaultKeepAliveIdleTime;
   /// @brief Default keep-alive packet interval in seconds
-  static const int defaultKeepAliveInterval = 75;
+  static const int defaultKeepAliveInterval = SocketProfile::defaultKeepAliveInterval;
   /// @brief Default number of the keep-alive packets
-  static const int defaultKeepAliveCount = 9;
+  static const int defaultKeepAliveCount = SocketProfile::defaultKeepAliveCount;
+  /// @brief Default number of client addresses tracked by the per-client connection rate limiter
+  static const size_t defaultNumberOfRateLimitedClientAddresses = 16;
+  /// @brief Default estimated memory size of one client connection in bytes
+  static const size_t defaultConnectionMemorySize = 2048;
+  /// @brief Maximum time to wait for the server task to stop in FreeRTOS ticks. Disable returns ESP_ERR_TIMEOUT after it
+  /// and the next Disable completes the stop when the task has finished its request handler.
+  static const TickType_t disableTimeout = 1000 / portTICK_PERIOD_MS;
+  /// @brief Maximum time the task of an idle server waits for the socket events in FreeRTOS ticks
+  /// (the client streams that are closed by the other tasks are removed after it)
+  static const TickType_t maxIdleWaitTime = 1000 / portTICK_PERIOD_MS;
 
   /// @brief Client connected event
   Event<TcpServer, NetworkStream&> clientConnectedEvent;
@@ -40,6 +98,12 @@ public:
   esp_err_t Enable() override;
   esp_err_t Disable() override;
 
+  /// @brief Stops accepting new connections, calls HandleDrain for the connected clients, waits for the clients to disconnect
+  /// and disables the server (the clients that are still connected after the timeout are closed)
+  /// @param timeout timeout in FreeRTOS ticks
+  /// @return error code
+  esp_err_t Drain(TickType_t timeout);
+
   /// @brief Enables the Nagle's algorithm
   /// @return error code
   esp_err_t EnableNagleAlgorithm();
@@ -73,6 +137,42 @@ public:
   /// @return error code
   esp_err_t SetTaskParameters(const TaskParameters& taskParameters);
 
+  /// @brief Sets the host that runs the server in its shared task instead of the own server task.
+  /// The task parameters and the static task memory are ignored while the host is set.
+  /// @param host server host (null - own server task)
+  /// @return error code
+  esp_err_t SetHost(TcpServerHost* host);
+
+  /// @brief Enables the manual polling mode. No server task is created: the application calls Poll from its own loop.
+  /// @return error code
+  esp_err_t EnableManualPolling();
+
+  /// @brief Disables the manual polling mode
+  /// @return error code
+  esp_err_t DisableManualPolling();
+
+  /// @brief Waits for a new connection or client data and handles them once (manual polling mode)
+  /// @param timeout timeout in FreeRTOS ticks (0 - no wait)
+  /// @return error code
+  esp_err_t Poll(TickType_t timeout = 0);
+
+  /// @brief Sets the statically allocated server task stack and control block.
+  /// The task is created with xTaskCreateStaticPinnedToCore on the first enable and is parked (not deleted) while the server is disabled.
+  /// The task stack depth of the task parameters is ignored and the core ID is only applied when the task is created.
+  /// @param stack task stack (null - dynamically allocated task)
+  /// @param stackDepth task stack depth (number of StackType_t elements)
+  /// @param taskBuffer task control block
+  /// @return error code
+  esp_err_t SetStaticTaskMemory(StackType_t* stack, uint32_t stackDepth, StaticTask_t* taskBuffer);
+
+  /// @brief Sets the statically allocated client streams that replace the heap-allocated client stream pool.
+  /// The maximum number of clients is set to the number of streams and cannot exceed it.
+  /// New connections are rejected when all streams are in use.
+  /// @param streams client streams (null - heap-allocated client stream pool)
+  /// @param numberOfStreams number of streams
+  /// @return error code
+  esp_err_t SetStaticClientStreams(NetworkStream* streams, size_t numberOfStreams);
+
   /// @brief Sets the idle time before the keep-alive packets are sent
   /// @param seconds time in seconds
   /// @return error code
@@ -88,33 +188,344 @@ public:
   /// @return error code
   esp_err_t SetKeepAliveCount(int count);
 
+  /// @brief Gets the socket profile of the client streams
+  /// @return socket profile
+  SocketProfile GetSocketProfile();
+
+  /// @brief Sets the socket profile of the client streams. The profile is applied to the connected clients and to each new client once on connection.
+  /// @param profile socket profile
+  /// @return error code
+  esp_err_t SetSocketProfile(const SocketProfile& profile);
+
+  /// @brief Adds a rule that allows the connections from the clients with the matching address
+  /// @param prefix client address prefix
+  /// @return error code
+  esp_err_t AllowClients(const NetworkAddressPrefix& prefix);
+
+  /// @brief Adds a rule that denies the connections from the clients with the matching address
+  /// @param prefix client address prefix
+  /// @return error code
+  esp_err_t DenyClients(const NetworkAddressPrefix& prefix);
+
+  /// @brief Allows the connections from the clients that do not match any access rule
+  /// @return error code
+  esp_err_t AllowClientsByDefault();
+
+  /// @brief Denies the connections from the clients that do not match any access rule
+  /// @return error code
+  esp_err_t DenyClientsByDefault();
+
+  /// @brief Removes all client access rules
+  /// @return error code
+  esp_err_t ClearClientAccessRules();
+
+  /// @brief Checks if the connection from the client with the specified address is allowed
+  /// @param address client address
+  /// @return true if the first matching access rule allows the connection (or the default access if no rule matches)
+  bool IsClientAllowed(const NetworkAddress& address);
+
+  /// @brief Sets the total rate of the accepted connections. Excess connections are closed right after they are accepted.
+  /// @param connectionsPerSecond rate in connections per second (0 - no limit)
+  /// @param burst number of connections that can be accepted at once
+  /// @return error code
+  esp_err_t SetConnectionRateLimit(uint32_t connectionsPerSecond, uint32_t burst);
+
+  /// @brief Sets the rate of the accepted connections from a single client address.
+  /// Excess connections are closed right after they are accepted.
+  /// @param connectionsPerSecond rate in connections per second (0 - no limit)
+  /// @param burst number of connections that can be accepted at once
+  /// @param numberOfAddresses number of the client addresses to track (the addresses that do not fit share one limit)
+  /// @return error code
+  esp_err_t SetClientConnectionRateLimit(uint32_t connectionsPerSecond, uint32_t burst, size_t numberOfAddresses = defaultNumberOfRateLimitedClientAddresses);
+
+  /// @brief Gets the number of connections closed by the connection rate limiters
+  /// @return number of connections
+  size_t GetNumberOfRateLimitedConnections();
+
+  /// @brief Gets the server statistics. The method does not lock the server.
+  /// @return statistics
+  TcpServerStatistics GetStatistics();
+
+  /// @brief Sets the total read data rate limit of all clients. The server task does not wait for the tokens:
+  /// the clients are not handled while the limit is exhausted. NetworkStream::SetSharedRateLimitExempt exempts a client from the limit.
+  /// @param bytesPerSecond rate in bytes per second (0 - no limit)
+  /// @param burst number of bytes that can be read without pacing
+  /// @return error code
+  esp_err_t SetReadRateLimit(uint32_t bytesPerSecond, uint32_t burst);
+
+  /// @brief Sets the total write data rate limit of all clients. The server task does not wait for the tokens:
+  /// the clients are not handled while the limit is exhausted. NetworkStream::SetSharedRateLimitExempt exempts a client from the limit.
+  /// @param bytesPerSecond rate in bytes per second (0 - no limit)
+  /// @param burst number of bytes that can be written without pacing
+  /// @return error code
+  esp_err_t SetWriteRateLimit(uint32_t bytesPerSecond, uint32_t burst);
+
+  /// @brief Sets the budget of a single request handler call. The clients are handled in the round-robin order and
+  /// GetReadableSize of the client stream returns 0 when the budget (multiplied by the stream weight) is exhausted,
+  /// so that a handler that reads while data is readable returns and the other clients are handled.
+  /// @param numberOfBytes number of bytes that can be read (0 - no limit)
+  /// @param time time in microseconds (0 - no limit)
+  /// @return error code
+  esp_err_t SetHandleRequestBudget(size_t numberOfBytes, uint32_t time);
+
+  /// @brief Sets the memory budget of the client connections. New connections that exceed the budget are closed right after they are accepted.
+  /// @param connectionMemorySize estimated memory size of one connection (client stream, socket buffers, lwIP control blocks)
+  /// @param maxMemorySize maximum memory size of all connections (0 - no limit)
+  /// @param freeHeapWatermark free internal heap size that must remain after the new connection is admitted (0 - no check)
+  /// @return error code
+  esp_err_t SetMemoryBudget(size_t connectionMemorySize, size_t maxMemorySize, size_t freeHeapWatermark);
+
+  /// @brief Sets the socket receive buffer size of the new connections that are accepted while the free internal heap is low.
+  /// Requires CONFIG_LWIP_SO_RCVBUF (ESP_ERR_NOT_SUPPORTED is returned if it is not enabled).
+  /// @param freeHeapSize free internal heap size below which the receive buffer is reduced (0 - receive buffer is not reduced)
+  /// @param receiveBufferSize receive buffer size in bytes
+  /// @return error code
+  esp_err_t SetLowMemoryReceiveBufferSize(size_t freeHeapSize, int receiveBufferSize);
+
+  /// @brief Gets the buffer allocator of the client streams and the client event rings
+  /// @return allocator
+  std::shared_ptr<NetworkBufferAllocator> GetBufferAllocator();
+
+  /// @brief Sets the buffer allocator of the client streams and the client event rings
+  /// @param allocator allocator (null - default allocator)
+  /// @return error code
+  esp_err_t SetBufferAllocator(std::shared_ptr<NetworkBufferAllocator> allocator);
+
+  /// @brief Gets the client event dispatch mode
+  /// @return mode
+  TcpServerEventDispatchMode GetEventDispatchMode();
+
+  /// @brief Sets the client event (clientConnectedEvent, clientDisconnectedEvent) dispatch mode of the disabled server.
+  /// In the dispatcher task mode the events that do not fit into the full queue are kept in order by the server task and queued in the next iterations
+  /// (new clients are not accepted while the kept events take the room reserved for the client events).
+  /// @param mode mode
+  /// @param queueSize event queue size (dispatcher task mode)
+  /// @param taskParameters dispatcher task parameters (dispatcher task mode)
+  /// @return error code
+  esp_err_t SetEventDispatchMode(TcpServerEventDispatchMode mode, size_t queueSize = defaultEventQueueSize,
+                                 const TaskParameters& taskParameters = defaultEventDispatcherTaskParameters);
+
 protected:
   /// @brief Handles the TCP client request
   /// @param clientStream client stream
   /// @return error code
   virtual esp_err_t HandleRequest(NetworkStream& clientStream) = 0;
 
+  /// @brief Handles the TCP client when the server is drained (e.g. sends a "going away" message). Called by the server task. Does nothing by default.
+  /// @param clientStream client stream
+  /// @return error code
+  virtual esp_err_t HandleDrain(NetworkStream& clientStream);
+
 private:
+  friend class TcpServerHost;
+
+  struct ClientAccessRule {
+    NetworkAddressPrefix prefix;
+    bool allow;
+  };
+
+  struct Configuration {
+    uint16_t port = 0;
+    size_t maxNumberOfClients = defaultMaxNumberOfClients;
+    SocketProfile socketProfile;
+    std::vector<ClientAccessRule> clientAccessRules;
+    bool clientsAllowedByDefault = true;
+    size_t handleRequestByteBudget = 0;
+    uint32_t handleRequestTimeBudget = 0;
+    size_t connectionMemorySize = defaultConnectionMemorySize;
+    size_t maxConnectionMemorySize = 0;
+    size_t freeHeapWatermark = 0;
+    size_t lowMemoryFreeHeapSize = 0;
+    int lowMemoryReceiveBufferSize = 0;
+  };
+
+  struct ClientEvent {
+    std::shared_ptr<NetworkStream> stream;
+    bool connected;
+  };
+
+  struct ClientConnectionRateLimiter {
+    NetworkAddress address;
+    TokenBucket tokenBucket;
+    int64_t lastConnectionTime;
+  };
+
+  // Two buffers of a value that is read without locking. The writer (serialized by the server lock) updates the inactive buffer
+  // when it has no readers and swaps the buffers, so that no heap is used for the updates.
+  template <class T>
+  class Snapshot {
+  public:
+    class Reader {
+    public:
+      Reader(Snapshot& snapshot) : snapshot(snapshot), previous(lastReader) {
+        // The reader is registered before the buffer is read, so that the writer does not update it
+        while (true) {
+          index = snapshot.activeIndex.load();
+          snapshot.numberOfReaders[index]++;
+          if (snapshot.activeIndex.load() == index)
+            break;
+          snapshot.numberOfReaders[index]--;
+        }
+        lastReader = this;
+      }
+      ~Reader() {
+        lastReader = previous;
+        snapshot.numberOfReaders[index]--;
+      }
+      Reader(const Reader&) = delete;
+      Reader& operator=(const Reader&) = delete;
+      const T& operator*() const { return snapshot.buffers[index]; }
+      const T* operator->() const { return &snapshot.buffers[index]; }
+
+    private:
+      friend class Snapshot;
+      // Readers of the current task (scoped, so they are destroyed in the reverse order)
+      static inline thread_local const Reader* lastReader = NULL;
+      Snapshot& snapshot;
+      const Reader* previous;
+      int index;
+    };
+
+    // Returns NULL if the current task reads the inactive buffer (it would wait for itself)
+    T* GetInactive() {
+      int index = 1 - activeIndex.load();
+      for (const Reader* reader = Reader::lastReader; reader; reader = reader->previous) {
+        if (&reader->snapshot == this && reader->index == index)
+          return NULL;
+      }
+      while (numberOfReaders[index])
+        vTaskDelay(1);
+      return &buffers[index];
+    }
+    void Swap() { activeIndex = 1 - activeIndex.load(); }
+
+  private:
+    T buffers[2];
+    std::atomic<int> activeIndex = {0};
+    std::atomic<uint32_t> numberOfReaders[2] = {};
+  };
+
   Mutex mutex;
-  uint16_t port = 0;
-  int maxNumberOfClients = defaultMaxNumberOfClients;
+  Snapshot<Configuration> configuration;
   std::vector<std::shared_ptr<NetworkStream>> clientStreams;
+  Snapshot<std::vector<std::shared_ptr<NetworkStream>>> publishedClientStreams;
+  NetworkStreamPool clientStreamPool;
   TaskParameters taskParameters = defaultTaskParameters;
-  bool nagleAlgorithmEnabled = true;
-  bool keepAliveEnabled = false;
-  int keepAliveIdleTime = defaultKeepAliveIdleTime;
-  int keepAliveInterval = defaultKeepAliveInterval;
-  int keepAliveCount = defaultKeepAliveCount;
+  TokenBucket connectionRateLimiter;
+  TokenBucket clientConnectionRateLimiterPrototype;
+  std::vector<ClientConnectionRateLimiter> clientConnectionRateLimiters;
+  TokenBucket clientConnectionOverflowRateLimiter;
+  std::atomic<uint32_t> numberOfAcceptedConnections = {0};
+  std::atomic<uint32_t> numberOfDeniedConnections = {0};
+  std::atomic<uint32_t> numberOfRateLimitedConnections = {0};
+  std::atomic<uint32_t> numberOfMemoryLimitedConnections = {0};
+  std::atomic<uint32_t> numberOfDisconnections[(int)NetworkStreamCloseReason::error + 1] = {};
+  std::atomic<uint32_t> numberOfHandledRequests = {0};
+  std::atomic<uint32_t> handleRequestDurationHistogram[TcpServerStatistics::handleRequestDurationHistogramSize] = {};
+  std::shared_ptr<SharedTokenBucket> readTokenBucket;
+  std::shared_ptr<SharedTokenBucket> writeTokenBucket;
+  std::shared_ptr<NetworkBufferAllocator> bufferAllocator;
   TaskHandle_t taskHandle = NULL;
-  bool disable = false;
-  bool disableFromRequest = false;
-  bool enableFromRequest = false;
+  uint32_t numberOfStartedTasks = 0;
+  std::atomic<bool> enabled = {false};
+  TcpServerHost* host = NULL;
+  int listenSock = -1;
+  bool manualPolling = false, manuallyEnabled = false;
+  TaskHandle_t pollingTaskHandle = NULL;
+  StackType_t* staticTaskStack = NULL;
+  uint32_t staticTaskStackDepth = 0;
+  StaticTask_t* staticTaskBuffer = NULL;
+  TaskHandle_t staticTaskHandle = NULL;
+  size_t numberOfStaticClientStreams = 0;
+  StaticSemaphore_t taskStoppedSemaphoreBuffer;
+  SemaphoreHandle_t taskStoppedSemaphore;
+  StaticSemaphore_t taskWakeSemaphoreBuffer;
+  SemaphoreHandle_t taskWakeSemaphore;
+  std::atomic<int> wakeSock = {-1};
+  StaticSemaphore_t drainedSemaphoreBuffer;
+  SemaphoreHandle_t drainedSemaphore;
+  bool draining = false;
+  bool drainRequested = false;
+  bool processAgain = false;
+  size_t firstHandledClientIndex = 0;
+  TcpServerEventDispatchMode eventDispatchMode = TcpServerEventDispatchMode::immediate;
+  NetworkBufferArray<ClientEvent> eventQueue;
+  std::atomic<size_t> eventQueueHead = {0};
+  std::atomic<size_t> eventQueueTail = {0};
+  NetworkBufferArray<ClientEvent> pendingClientEvents;
+  size_t pendingClientEventsHead = 0;
+  size_t numberOfPendingClientEvents = 0;
+  TaskHandle_t eventDispatcherTaskHandle = NULL;
+  std::atomic<bool> stopEventDispatcher = {false};
+  StaticSemaphore_t eventDispatcherStoppedSemaphoreBuffer;
+  SemaphoreHandle_t eventDispatcherStoppedSemaphore;
+  StaticSemaphore_t eventDispatcherWakeSemaphoreBuffer;
+  SemaphoreHandle_t eventDispatcherWakeSemaphore;
+  std::atomic<bool> disable = {false};
+  std::atomic<bool> disableFromRequest = {false};
+  std::atomic<bool> enableFromRequest = {false};
 
-  esp_err_t SetStreamSocketOptions();
+  Snapshot<Configuration>::Reader GetConfiguration();
+  Configuration* CopyConfiguration();
+  void StoreConfiguration();
+  void PublishClientStreams();
+  esp_err_t ApplySocketProfile();
+  bool IsConnectionRateAllowed(const NetworkAddress& address);
+  bool IsConnectionMemoryAvailable();
   static void TaskCode(void* parameters);
+  bool Process();
+  TickType_t PrepareWait(fd_set& set, int& maxSock);
+  void WakeTask();
+  static void WaitForEvents(fd_set& set, int maxSock, int wakeSock, SemaphoreHandle_t wakeSemaphore, TickType_t timeout);
+  void DeleteStaticTask();
+  static void CloseRejectedSocket(int sock);
+  void AddHandleRequestDuration(int64_t duration);
+  esp_err_t ReservePendingClientEvents(size_t maxNumberOfClients);
+  esp_err_t AllocatePendingClientEvents(std::shared_ptr<NetworkBufferAllocator> allocator, size_t size);
+  void AddClientEvent(const std::shared_ptr<NetworkStream>& clientStream, bool connected);
+  bool TakePendingClientEvent(ClientEvent& clientEvent);
+  void GenerateClientEvent(ClientEvent& clientEvent);
+  void GeneratePendingClientEvents();
+  void QueuePendingClientEvents();
+  bool QueueClientEvent(ClientEvent& clientEvent);
+  void DispatchQueuedClientEvents();
+  esp_err_t StartEventDispatcher(size_t queueSize, const TaskParameters& taskParameters);
+  esp_err_t StopEventDispatcher(TickType_t timeout);
+  static void EventDispatcherTaskCode(void* parameters);
 
   int Listen();
-  esp_err_t RestartIfEnabled(); 
+  esp_err_t StartTask();
+  esp_err_t StopTask();
+  void Stop();
+};
+
+//==============================================================================
+
+/// @brief TCP server with the statically allocated task stack, task control block and client streams (the server footprint is known at link time)
+/// @tparam capacity maximum number of clients
+/// @tparam stackDepth server task stack depth (number of StackType_t elements)
+template <size_t capacity, uint32_t stackDepth = 4096>
+class StaticTcpServer : public TcpServer {
+public:
+  /// @brief Creates a static TCP server
+  /// @param port port
+  StaticTcpServer(uint16_t port) : TcpServer(port) {
+    SetStaticClientStreams(staticClientStreams, capacity);
+    SetStaticTaskMemory(taskStack, stackDepth, &taskBuffer);
+  }
+  ~StaticTcpServer() {
+    // The task and the streams must be released before the memory is destroyed.
+    // Disable is repeated until the task stops, so the task cannot keep running on the destroyed stack.
+    esp_err_t error;
+    while ((error = Disable()) == ESP_ERR_TIMEOUT);
+    ESP_ERROR_CHECK(error);
+    ESP_ERROR_CHECK(SetStaticTaskMemory(NULL, 0, NULL));
+  }
+
+private:
+  NetworkStream staticClientStreams[capacity];
+  StackType_t taskStack[stackDepth];
+  StaticTask_t taskBuffer;
 };
 
 //==============================================================================
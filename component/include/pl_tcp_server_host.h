@@ -0,0 +1,66 @@
+#pragma once
+#include "pl_tcp_server.h"
+#include <vector>
+
+//==============================================================================
+
+namespace PL {
+
+//==============================================================================
+
+/// @brief TCP server host class that runs several TCP servers in one shared task.
+/// Each server keeps its own request handling, events and configuration. The idle task waits for the socket events of all servers in one select call.
+class TcpServerHost : public Lockable {
+public:
+  /// @brief Default host task parameters
+  static const TaskParameters defaultTaskParameters;
+  /// @brief Default host task name
+  static const std::string defaultTaskName;
+
+  /// @brief Creates a TCP server host
+  TcpServerHost();
+  ~TcpServerHost();
+  TcpServerHost(const TcpServerHost&) = delete;
+  TcpServerHost& operator=(const TcpServerHost&) = delete;
+
+  esp_err_t Lock(TickType_t timeout = portMAX_DELAY) override;
+  esp_err_t Unlock() override;
+
+  /// @brief Gets the host task parameters
+  /// @return task parameters
+  TaskParameters GetTaskParameters();
+
+  /// @brief Sets the host task parameters (applied when the task is created for the first enabled server)
+  /// @param taskParameters task parameters
+  /// @return error code
+  esp_err_t SetTaskParameters(const TaskParameters& taskParameters);
+
+  /// @brief Gets the number of the enabled servers run by the host
+  /// @return number of servers
+  size_t GetNumberOfServers();
+
+private:
+  friend class TcpServer;
+
+  Mutex mutex;
+  TaskParameters taskParameters = defaultTaskParameters;
+  TaskHandle_t taskHandle = NULL;
+  std::vector<TcpServer*> servers;
+  std::vector<TcpServer*> processedServers;
+  std::vector<TcpServer*> attachedServers;
+  StaticSemaphore_t taskStoppedSemaphoreBuffer;
+  SemaphoreHandle_t taskStoppedSemaphore;
+  StaticSemaphore_t taskWakeSemaphoreBuffer;
+  SemaphoreHandle_t taskWakeSemaphore;
+  std::atomic<int> wakeSock = {-1};
+
+  esp_err_t AddServer(TcpServer& server, TaskHandle_t* taskHandle);
+  void AttachServer(TcpServer& server);
+  void DetachServer(TcpServer& server);
+  void Wake();
+  static void TaskCode(void* parameters);
+};
+
+//==============================================================================
+
+}
\ No newline at end of file
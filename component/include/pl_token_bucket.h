@@ -0,0 +1,116 @@
+#pragma once
+#include "pl_common.h"
+#include "stdint.h"
+
+//==============================================================================
+
+namespace PL {
+
+//==============================================================================
+
+/// @brief Token bucket (rate limiter). The class is not thread-safe, the owner should serialize access.
+class TokenBucket {
+public:
+  /// @brief Creates a token bucket with no rate limit
+  TokenBucket();
+
+  /// @brief Creates a full token bucket
+  /// @param rate token rate in tokens per second (0 - no limit)
+  /// @param capacity maximum number of tokens in the bucket (burst size)
+  TokenBucket(uint32_t rate, uint32_t capacity);
+
+  /// @brief Takes the tokens if enough tokens are available
+  /// @param count number of tokens
+  /// @return true if the tokens are taken
+  bool TryTake(uint32_t count = 1);
+
+  /// @brief Takes the tokens even if not enough tokens are available (the missing tokens are taken from the future refills)
+  /// @param count number of tokens
+  void Take(uint32_t count);
+
+  /// @brief Gets the number of available tokens
+  /// @return number of tokens
+  uint32_t GetAvailableTokens();
+
+  /// @brief Gets the time until the specified number of tokens is available
+  /// @param count number of tokens
+  /// @return time in microseconds
+  int64_t GetRefillTime(uint32_t count = 1);
+
+  /// @brief Checks if the bucket limits the rate
+  /// @return true if the rate is limited
+  bool IsLimited() const;
+
+  /// @brief Gets the token rate
+  /// @return rate in tokens per second
+  uint32_t GetRate() const;
+
+  /// @brief Gets the bucket capacity
+  /// @return number of tokens
+  uint32_t GetCapacity() const;
+
+private:
+  uint32_t rate = 0;
+  uint32_t capacity = 0;
+  // Tokens are stored multiplied by 1000000 to allow microsecond refill resolution
+  int64_t scaledTokens = 0;
+  int64_t lastRefillTime = 0;
+
+  void Refill();
+};
+
+//==============================================================================
+
+/// @brief Thread-safe token bucket that can be shared between several objects
+class SharedTokenBucket : public Lockable {
+public:
+  /// @brief Creates a shared token bucket with no rate limit
+  SharedTokenBucket() {}
+
+  esp_err_t Lock(TickType_t timeout = portMAX_DELAY) override;
+  esp_err_t Unlock() override;
+
+  /// @brief Takes the tokens if enough tokens are available
+  /// @param count number of tokens
+  /// @return true if the tokens are taken
+  bool TryTake(uint32_t count = 1);
+
+  /// @brief Takes the tokens even if not enough tokens are available (the missing tokens are taken from the future refills)
+  /// @param count number of tokens
+  void Take(uint32_t count);
+
+  /// @brief Gets the number of available tokens
+  /// @return number of tokens
+  uint32_t GetAvailableTokens();
+
+  /// @brief Gets the time until the specified number of tokens is available
+  /// @param count number of tokens
+  /// @return time in microseconds
+  int64_t GetRefillTime(uint32_t count = 1);
+
+  /// @brief Checks if the bucket limits the rate
+  /// @return true if the rate is limited
+  bool IsLimited();
+
+  /// @brief Gets the token rate
+  /// @return rate in tokens per second
+  uint32_t GetRate();
+
+  /// @brief Gets the bucket capacity
+  /// @return number of tokens
+  uint32_t GetCapacity();
+
+  /// @brief Sets the token rate and refills the bucket
+  /// @param rate token rate in tokens per second (0 - no limit)
+  /// @param capacity maximum number of tokens in the bucket (burst size)
+  /// @return error code
+  esp_err_t SetRate(uint32_t rate, uint32_t capacity);
+
+private:
+  Mutex mutex;
+  TokenBucket tokenBucket;
+};
+
+//==============================================================================
+
+}
\ No newline at end of file
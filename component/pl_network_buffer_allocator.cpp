@@ -0,0 +1,149 @@
+#include "pl_network_buffer_allocator.h"
+#include "esp_check.h"
+#include <stdlib.h>
+
+//==============================================================================
+
+static const char* TAG = "pl_network_buffer_allocator";
+
+//==============================================================================
+
+namespace PL {
+
+//==============================================================================
+
+NetworkBufferAllocator::NetworkBufferAllocator(uint32_t caps, uint32_t fallbackCaps, size_t maxNumberOfFreeBuffers) :
+  caps(caps), fallbackCaps(fallbackCaps), maxNumberOfFreeBuffers(maxNumberOfFreeBuffers) {}
+
+//==============================================================================
+
+NetworkBufferAllocator::~NetworkBufferAllocator() {
+  Trim();
+}
+
+//==============================================================================
+
+esp_err_t NetworkBufferAllocator::Lock(TickType_t timeout) {
+  esp_err_t error = mutex.Lock(timeout);
+  if (error == ESP_OK)
+    return ESP_OK;
+  if (error == ESP_ERR_TIMEOUT && timeout == 0)
+    return ESP_ERR_TIMEOUT;
+  ESP_RETURN_ON_ERROR(error, TAG, "mutex lock failed");
+  return ESP_OK;
+}
+
+//==============================================================================
+
+esp_err_t NetworkBufferAllocator::Unlock() {
+  ESP_RETURN_ON_ERROR(mutex.Unlock(), TAG, "mutex unlock failed");
+  return ESP_OK;
+}
+
+//==============================================================================
+
+void* NetworkBufferAllocator::Allocate(size_t size) {
+  size_t sizeClassIndex = GetSizeClassIndex(size);
+  if (sizeClassIndex == numberOfSizeClasses)
+    return AllocateFromHeap(size);
+
+  {
+    LockGuard lg(*this);
+    if (FreeBuffer* buffer = freeLists[sizeClassIndex]) {
+      freeLists[sizeClassIndex] = buffer->next;
+      numberOfFreeBuffers[sizeClassIndex]--;
+      return buffer;
+    }
+  }
+  return AllocateFromHeap(minSizeClass << sizeClassIndex);
+}
+
+//==============================================================================
+
+void NetworkBufferAllocator::Free(void* buffer, size_t size) {
+  if (!buffer)
+    return;
+  size_t sizeClassIndex = GetSizeClassIndex(size);
+  if (sizeClassIndex < numberOfSizeClasses) {
+    LockGuard lg(*this);
+    if (numberOfFreeBuffers[sizeClassIndex] < maxNumberOfFreeBuffers) {
+      // The free list link is stored in the buffer itself (the smallest size class is larger than the link)
+      FreeBuffer* freeBuffer = (FreeBuffer*)buffer;
+      freeBuffer->next = freeLists[sizeClassIndex];
+      freeLists[sizeClassIndex] = freeBuffer;
+      numberOfFreeBuffers[sizeClassIndex]++;
+      return;
+    }
+  }
+  FreeToHeap(buffer);
+}
+
+//==============================================================================
+
+void NetworkBufferAllocator::Trim() {
+  LockGuard lg(*this);
+  for (size_t i = 0; i < numberOfSizeClasses; i++) {
+    while (FreeBuffer* buffer = freeLists[i]) {
+      freeLists[i] = buffer->next;
+      FreeToHeap(buffer);
+    }
+    numberOfFreeBuffers[i] = 0;
+  }
+}
+
+//==============================================================================
+
+size_t NetworkBufferAllocator::GetNumberOfFreeBuffers() {
+  LockGuard lg(*this);
+  size_t numberOfBuffers = 0;
+  for (size_t i = 0; i < numberOfSizeClasses; i++)
+    numberOfBuffers += numberOfFreeBuffers[i];
+  return numberOfBuffers;
+}
+
+//==============================================================================
+
+std::shared_ptr<NetworkBufferAllocator> NetworkBufferAllocator::GetDefault() {
+#if CONFIG_IDF_TARGET_LINUX
+  static auto defaultAllocator = std::make_shared<NetworkBufferAllocator>(0);
+#else
+  static auto defaultAllocator = std::make_shared<NetworkBufferAllocator>(MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+#endif
+  return defaultAllocator;
+}
+
+//==============================================================================
+
+size_t NetworkBufferAllocator::GetSizeClassIndex(size_t size) {
+  size_t sizeClassIndex = 0;
+  while (sizeClassIndex < numberOfSizeClasses && (minSizeClass << sizeClassIndex) < size)
+    sizeClassIndex++;
+  return sizeClassIndex;
+}
+
+//==============================================================================
+
+void* NetworkBufferAllocator::AllocateFromHeap(size_t size) {
+#if CONFIG_IDF_TARGET_LINUX
+  return malloc(size);
+#else
+  void* buffer = heap_caps_malloc(size, caps);
+  if (!buffer && fallbackCaps)
+    buffer = heap_caps_malloc(size, fallbackCaps);
+  return buffer;
+#endif
+}
+
+//==============================================================================
+
+void NetworkBufferAllocator::FreeToHeap(void* buffer) {
+#if CONFIG_IDF_TARGET_LINUX
+  free(buffer);
+#else
+  heap_caps_free(buffer);
+#endif
+}
+
+//==============================================================================
+
+}
\ No newline at end of file
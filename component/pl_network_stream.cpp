@@ -1,5 +1,8 @@
 #include "pl_network_stream.h"
+#include "pl_network_trace.h"
 #include "esp_check.h"
+#include <algorithm>
+#include <string.h>
 
 //==============================================================================
 
@@ -11,16 +14,18 @@ namespace PL {
 
 //==============================================================================
 
-NetworkStream::NetworkStream(int sock) : sock(sock) {
-  SetReadTimeout(defaultReadTimeout);
+NetworkStream::NetworkStream(int sock) {
+  Open(sock);
 }
 
 //==============================================================================
 
 esp_err_t NetworkStream::Lock(TickType_t timeout) {
   esp_err_t error = mutex.Lock(timeout);
-  if (error == ESP_OK)
+  if (error == ESP_OK) {
+    PL_NETWORK_TRACE(streamLockAcquired, this, 0);
     return ESP_OK;
+  }
   if (error == ESP_ERR_TIMEOUT && timeout == 0)
     return ESP_ERR_TIMEOUT;
   ESP_RETURN_ON_ERROR(error, TAG, "mutex lock failed");
@@ -30,6 +35,7 @@ esp_err_t NetworkStream::Lock(TickType_t timeout) {
 //==============================================================================
 
 esp_err_t NetworkStream::Unlock() {
+  PL_NETWORK_TRACE(streamLockReleased, this, 0);
   ESP_RETURN_ON_ERROR(mutex.Unlock(), TAG, "mutex unlock failed");
   return ESP_OK;
 }
@@ -37,26 +43,46 @@ esp_err_t NetworkStream::Unlock() {
 //==============================================================================
 
 esp_err_t NetworkStream::Read(void* dest, size_t size) {
+  size_t readSize = 0;
+  PL_NETWORK_TRACE_SCOPE(readBegin, readEnd, this, size, readSize);
   LockGuard lg(*this);
   ESP_RETURN_ON_FALSE(sock >= 0, ESP_ERR_INVALID_STATE, TAG, "network stream is closed");
   if (!size)
     return ESP_OK;
  
-  int res;
+  int res = 0;
+  size_t initialSize = size;
   if (dest) {
-    for (; size && (res = recv(sock, (uint8_t*)dest, size, 0)) > 0; size -= res, dest = (uint8_t*)dest + res);
+    for (; size && (res = recv(sock, (uint8_t*)dest, WaitForTokens(readTokenBucket, size), 0)) > 0;
+         size -= res, dest = (uint8_t*)dest + res) {
+      numberOfReceiveCalls.fetch_add(1, std::memory_order_relaxed);
+      TakeTokens(readTokenBucket, sharedReadTokenBucket.get(), res);
+    }
   }
   else {
-    uint8_t data;
-    for (; size && recv(sock, &data, 1, 0) == 1; size--);
+    // Discarded data is received in chunks to a buffer of the stream allocator, which is kept until the stream is closed
+    if (!discardBuffer.GetSize())
+      ESP_RETURN_ON_ERROR(discardBuffer.Allocate(GetBufferAllocator(), discardBufferSize), TAG, "discard buffer allocate failed");
+    for (; size && (res = recv(sock, &discardBuffer[0], WaitForTokens(readTokenBucket, size < discardBufferSize ? size : discardBufferSize), 0)) > 0;
+         size -= res) {
+      numberOfReceiveCalls.fetch_add(1, std::memory_order_relaxed);
+      TakeTokens(readTokenBucket, sharedReadTokenBucket.get(), res);
+    }
   }
+  readSize = initialSize - size;
+  numberOfBytesRead.fetch_add(readSize, std::memory_order_relaxed);
+  readBudget -= std::min(readSize, readBudget);
 
   if (!size)
     return ESP_OK;
 
-  ESP_RETURN_ON_FALSE(errno != EAGAIN, ESP_ERR_TIMEOUT, TAG, "timeout");
+  numberOfReceiveCalls.fetch_add(1, std::memory_order_relaxed);
+  if (res < 0 && errno == EAGAIN) {
+    numberOfReadTimeouts.fetch_add(1, std::memory_order_relaxed);
+    ESP_RETURN_ON_ERROR(ESP_ERR_TIMEOUT, TAG, "timeout");
+  }
 
-  Close();
+  Close(res == 0 ? NetworkStreamCloseReason::remote : NetworkStreamCloseReason::error);
   ESP_RETURN_ON_ERROR(ESP_FAIL, TAG, "read failed");
   return ESP_OK;
 }
@@ -64,34 +90,73 @@ esp_err_t NetworkStream::Read(void* dest, size_t size) {
 //==============================================================================
 
 esp_err_t NetworkStream::Write(const void* src, size_t size) {
+  size_t writtenSize = 0;
+  PL_NETWORK_TRACE_SCOPE(writeBegin, writeEnd, this, size, writtenSize);
   LockGuard lg(*this);
   ESP_RETURN_ON_FALSE(sock >= 0, ESP_ERR_INVALID_STATE, TAG, "network stream is closed");
   if (!size)
     return ESP_OK;
   ESP_RETURN_ON_FALSE(src, ESP_ERR_INVALID_ARG, TAG, "src is null");
   
-  if (send(sock, src, size, 0) == size)
+  while (size) {
+    size_t chunkSize = WaitForTokens(writeTokenBucket, size);
+    int res = send(sock, src, chunkSize, MSG_NOSIGNAL);
+    numberOfSendCalls.fetch_add(1, std::memory_order_relaxed);
+    if (res > 0) {
+      writtenSize += res;
+      numberOfBytesWritten.fetch_add(res, std::memory_order_relaxed);
+    }
+    if (res != chunkSize) {
+      if (res >= 0)
+        numberOfShortSends.fetch_add(1, std::memory_order_relaxed);
+      break;
+    }
+    TakeTokens(writeTokenBucket, sharedWriteTokenBucket.get(), chunkSize);
+    size -= chunkSize;
+    src = (uint8_t*)src + chunkSize;
+  }
+
+  if (!size)
     return ESP_OK;
 
-  Close();
+  Close(NetworkStreamCloseReason::error);
   ESP_RETURN_ON_ERROR(ESP_FAIL, TAG, "write failed");
   return ESP_OK;
 }
 
 //==============================================================================
 
-esp_err_t NetworkStream::Close() {
+esp_err_t NetworkStream::Open(int sock) {
   LockGuard lg(*this);
-  if (sock < 0)
-    return ESP_OK;
-  int s = sock;
-  sock = -1;
-  ESP_RETURN_ON_FALSE(close(s) == 0, ESP_FAIL, TAG, "socket close failed (%d)", errno);
+  ESP_RETURN_ON_FALSE(this->sock < 0, ESP_ERR_INVALID_STATE, TAG, "network stream is open");
+  ESP_RETURN_ON_FALSE(sock >= 0, ESP_ERR_INVALID_ARG, TAG, "invalid socket");
+
+  this->sock = sock;
+  readTokenBucket = TokenBucket();
+  writeTokenBucket = TokenBucket();
+  sharedReadTokenBucket = nullptr;
+  sharedWriteTokenBucket = nullptr;
+  sharedRateLimitExempt = false;
+  numberOfBytesRead.store(0, std::memory_order_relaxed);
+  numberOfBytesWritten.store(0, std::memory_order_relaxed);
+  numberOfReceiveCalls.store(0, std::memory_order_relaxed);
+  numberOfSendCalls.store(0, std::memory_order_relaxed);
+  numberOfReadTimeouts.store(0, std::memory_order_relaxed);
+  numberOfShortSends.store(0, std::memory_order_relaxed);
+  closeReason.store(NetworkStreamCloseReason::none, std::memory_order_relaxed);
+  weight = defaultWeight;
+  ESP_RETURN_ON_ERROR(SetReadTimeout(defaultReadTimeout), TAG, "read timeout set failed");
   return ESP_OK;
 }
 
 //==============================================================================
 
+esp_err_t NetworkStream::Close() {
+  return Close(NetworkStreamCloseReason::local);
+}
+
+//==============================================================================
+
 esp_err_t NetworkStream::EnableNagleAlgorithm() {
   ESP_RETURN_ON_ERROR(SetSocketOption(IPPROTO_TCP, TCP_NODELAY, 0), TAG, "Nagle's algorithm enable failed");
   return ESP_OK;
@@ -131,24 +196,72 @@ size_t NetworkStream::GetReadableSize() {
   LockGuard lg(*this);
   if (sock < 0)
     return 0;
+  // Exhausted request handling budget hides the data until the next visit of the server
+  if (!readBudget || (readBudgetDeadline && GetTimeInMicroseconds() >= readBudgetDeadline))
+    return 0;
+  // Exhausted shared rate limits hide the data as well, so that the server task handles the other clients instead of waiting for the tokens
+  size_t maxReadableSize = readBudget;
+  if (sharedReadTokenBucket)
+    maxReadableSize = std::min<size_t>(maxReadableSize, sharedReadTokenBucket->GetAvailableTokens());
+  if (sharedWriteTokenBucket && !sharedWriteTokenBucket->GetAvailableTokens())
+    maxReadableSize = 0;
+  if (!maxReadableSize)
+    return 0;
   fd_set set;
   timeval timeout = {};
   FD_ZERO(&set);
   FD_SET(sock, &set);
   bool readyForRead = select(sock + 1, &set, NULL, NULL, &timeout);
   if (readyForRead) {
-    size_t dataSize = 0;
+    int dataSize = 0;
     ioctl(sock, FIONREAD, &dataSize);
-    if (dataSize)
-      return dataSize;
+    if (dataSize > 0)
+      return std::min((size_t)dataSize, maxReadableSize);
     
-    Close();
+    Close(NetworkStreamCloseReason::remote);
   }
   return 0;
 }
 
 //==============================================================================
 
+esp_err_t NetworkStream::WaitForData(TickType_t timeout) {
+  int sock;
+  {
+    LockGuard lg(*this);
+    ESP_RETURN_ON_FALSE(this->sock >= 0, ESP_ERR_INVALID_STATE, TAG, "network stream is closed");
+    sock = this->sock;
+  }
+
+  // The stream is not locked while waiting, so that the other tasks can write to it
+  fd_set set;
+  FD_ZERO(&set);
+  FD_SET(sock, &set);
+  timeval tv = {};
+  uint64_t timeoutMs = (uint64_t)timeout * portTICK_PERIOD_MS;
+  tv.tv_sec = timeoutMs / 1000;
+  tv.tv_usec = (timeoutMs % 1000) * 1000;
+  int res = select(sock + 1, &set, NULL, NULL, timeout == portMAX_DELAY ? NULL : &tv);
+  int selectErrno = errno;
+
+  LockGuard lg(*this);
+  // The stream can be closed (and the socket number reused) by another task while waiting
+  ESP_RETURN_ON_FALSE(this->sock == sock, ESP_ERR_INVALID_STATE, TAG, "network stream is closed");
+  ESP_RETURN_ON_FALSE(res >= 0, ESP_FAIL, TAG, "select failed (%d)", selectErrno);
+  if (!res)
+    return ESP_ERR_TIMEOUT;
+  // The socket is checked directly instead of GetReadableSize, which also hides the data while the request handling budget
+  // or the shared rate limits are exhausted. Readable socket without data is closed by the remote side.
+  int dataSize = 0;
+  ioctl(sock, FIONREAD, &dataSize);
+  if (dataSize <= 0)
+    Close(NetworkStreamCloseReason::remote);
+  ESP_RETURN_ON_FALSE(this->sock >= 0, ESP_ERR_INVALID_STATE, TAG, "network stream is closed");
+  return ESP_OK;
+}
+
+//==============================================================================
+
 TickType_t NetworkStream::GetReadTimeout() {
   LockGuard lg(*this);
   return readTimeout;
@@ -164,7 +277,7 @@ esp_err_t NetworkStream::SetReadTimeout(TickType_t timeout) {
 
   timeval tv = {};
   if (timeout != portMAX_DELAY) {
-    uint32_t timeoutMs = timeout * portTICK_PERIOD_MS;
+    uint64_t timeoutMs = (uint64_t)timeout * portTICK_PERIOD_MS;
     tv.tv_sec = timeoutMs / 1000;
     tv.tv_usec = (timeoutMs % 1000) * 1000;
   }
@@ -219,6 +332,169 @@ esp_err_t NetworkStream::SetKeepAliveCount(int count) {
 
 //==============================================================================
 
+esp_err_t NetworkStream::SetSocketProfile(const SocketProfile& profile) {
+  LockGuard lg(*this);
+  ESP_RETURN_ON_ERROR(SocketProfile::Validate(profile), TAG, "invalid socket profile");
+  ESP_RETURN_ON_ERROR(SetSocketOption(IPPROTO_TCP, TCP_NODELAY, !profile.nagleAlgorithmEnabled), TAG, "Nagle's algorithm set failed");
+  ESP_RETURN_ON_ERROR(SetSocketOption(SOL_SOCKET, SO_KEEPALIVE, profile.keepAliveEnabled), TAG, "keep-alive set failed");
+  // Keep-alive timings are only used when the keep-alive is enabled
+  if (profile.keepAliveEnabled) {
+    ESP_RETURN_ON_ERROR(SetKeepAliveIdleTime(profile.keepAliveIdleTime), TAG, "keep-alive idle time set failed");
+    ESP_RETURN_ON_ERROR(SetKeepAliveInterval(profile.keepAliveInterval), TAG, "keep-alive interval set failed");
+    ESP_RETURN_ON_ERROR(SetKeepAliveCount(profile.keepAliveCount), TAG, "keep-alive count set failed");
+  }
+
+  if (profile.dscp >= 0) {
+    // DSCP occupies the upper 6 bits of the IPv4 type of service and the IPv6 traffic class
+    ESP_RETURN_ON_ERROR(SetSocketOption(IPPROTO_IP, IP_TOS, profile.dscp << 2), TAG, "type of service set failed");
+#ifdef IPV6_TCLASS
+    if (sock >= 0 && GetLocalEndpoint().address.family == NetworkAddressFamily::ipV6)
+      ESP_RETURN_ON_ERROR(SetSocketOption(IPPROTO_IPV6, IPV6_TCLASS, profile.dscp << 2), TAG, "traffic class set failed");
+#endif
+  }
+
+  if (profile.receiveBufferSize > 0) {
+#if CONFIG_IDF_TARGET_LINUX || CONFIG_LWIP_SO_RCVBUF
+    ESP_RETURN_ON_ERROR(SetSocketOption(SOL_SOCKET, SO_RCVBUF, profile.receiveBufferSize), TAG, "receive buffer size set failed");
+#else
+    ESP_RETURN_ON_ERROR(ESP_ERR_NOT_SUPPORTED, TAG, "receive buffer size requires CONFIG_LWIP_SO_RCVBUF");
+#endif
+  }
+
+  if (profile.sendBufferSize > 0) {
+#if CONFIG_IDF_TARGET_LINUX
+    ESP_RETURN_ON_ERROR(SetSocketOption(SOL_SOCKET, SO_SNDBUF, profile.sendBufferSize), TAG, "send buffer size set failed");
+#else
+    ESP_RETURN_ON_ERROR(ESP_ERR_NOT_SUPPORTED, TAG, "send buffer size is not supported by lwIP");
+#endif
+  }
+
+  if (profile.lingerTime >= 0) {
+#if CONFIG_IDF_TARGET_LINUX || CONFIG_LWIP_SO_LINGER
+    linger lingerOption = {1, profile.lingerTime};
+    ESP_RETURN_ON_FALSE(sock < 0 || setsockopt(sock, SOL_SOCKET, SO_LINGER, &lingerOption, sizeof(lingerOption)) >= 0, ESP_FAIL, TAG, "linger set failed (%d)", errno);
+#else
+    ESP_RETURN_ON_ERROR(ESP_ERR_NOT_SUPPORTED, TAG, "linger requires CONFIG_LWIP_SO_LINGER");
+#endif
+  }
+  return ESP_OK;
+}
+
+//==============================================================================
+
+esp_err_t NetworkStream::SetReadRateLimit(uint32_t bytesPerSecond, uint32_t burst) {
+  LockGuard lg(*this);
+  ESP_RETURN_ON_FALSE(!bytesPerSecond || burst, ESP_ERR_INVALID_ARG, TAG, "burst is zero");
+  readTokenBucket = TokenBucket(bytesPerSecond, burst);
+  return ESP_OK;
+}
+
+//==============================================================================
+
+esp_err_t NetworkStream::SetWriteRateLimit(uint32_t bytesPerSecond, uint32_t burst) {
+  LockGuard lg(*this);
+  ESP_RETURN_ON_FALSE(!bytesPerSecond || burst, ESP_ERR_INVALID_ARG, TAG, "burst is zero");
+  writeTokenBucket = TokenBucket(bytesPerSecond, burst);
+  return ESP_OK;
+}
+
+//==============================================================================
+
+esp_err_t NetworkStream::SetSharedReadTokenBucket(std::shared_ptr<SharedTokenBucket> tokenBucket) {
+  LockGuard lg(*this);
+  sharedReadTokenBucket = sharedRateLimitExempt ? nullptr : tokenBucket;
+  return ESP_OK;
+}
+
+//==============================================================================
+
+esp_err_t NetworkStream::SetSharedWriteTokenBucket(std::shared_ptr<SharedTokenBucket> tokenBucket) {
+  LockGuard lg(*this);
+  sharedWriteTokenBucket = sharedRateLimitExempt ? nullptr : tokenBucket;
+  return ESP_OK;
+}
+
+//==============================================================================
+
+bool NetworkStream::IsSharedRateLimitExempt() {
+  LockGuard lg(*this);
+  return sharedRateLimitExempt;
+}
+
+//==============================================================================
+
+esp_err_t NetworkStream::SetSharedRateLimitExempt(bool exempt) {
+  LockGuard lg(*this);
+  sharedRateLimitExempt = exempt;
+  if (exempt) {
+    sharedReadTokenBucket = nullptr;
+    sharedWriteTokenBucket = nullptr;
+  }
+  return ESP_OK;
+}
+
+//==============================================================================
+
+std::shared_ptr<NetworkBufferAllocator> NetworkStream::GetBufferAllocator() {
+  LockGuard lg(*this);
+  return bufferAllocator ? bufferAllocator : NetworkBufferAllocator::GetDefault();
+}
+
+//==============================================================================
+
+esp_err_t NetworkStream::SetBufferAllocator(std::shared_ptr<NetworkBufferAllocator> allocator) {
+  LockGuard lg(*this);
+  discardBuffer.Free();
+  bufferAllocator = allocator;
+  return ESP_OK;
+}
+
+//==============================================================================
+
+uint32_t NetworkStream::GetWeight() {
+  LockGuard lg(*this);
+  return weight;
+}
+
+//==============================================================================
+
+esp_err_t NetworkStream::SetWeight(uint32_t weight) {
+  LockGuard lg(*this);
+  ESP_RETURN_ON_FALSE(weight, ESP_ERR_INVALID_ARG, TAG, "weight is zero");
+  this->weight = weight;
+  return ESP_OK;
+}
+
+//==============================================================================
+
+NetworkStreamStatistics NetworkStream::GetStatistics() {
+  NetworkStreamStatistics statistics;
+  statistics.numberOfBytesRead = numberOfBytesRead.load(std::memory_order_relaxed);
+  statistics.numberOfBytesWritten = numberOfBytesWritten.load(std::memory_order_relaxed);
+  statistics.numberOfReceiveCalls = numberOfReceiveCalls.load(std::memory_order_relaxed);
+  statistics.numberOfSendCalls = numberOfSendCalls.load(std::memory_order_relaxed);
+  statistics.numberOfReadTimeouts = numberOfReadTimeouts.load(std::memory_order_relaxed);
+  statistics.numberOfShortSends = numberOfShortSends.load(std::memory_order_relaxed);
+  statistics.closeReason = closeReason.load(std::memory_order_relaxed);
+  return statistics;
+}
+
+//==============================================================================
+
+esp_err_t NetworkStream::Close(NetworkStreamCloseReason reason) {
+  LockGuard lg(*this);
+  if (sock < 0)
+    return ESP_OK;
+  int s = sock;
+  sock = -1;
+  closeReason.store(reason, std::memory_order_relaxed);
+  discardBuffer.Free();
+  ESP_RETURN_ON_FALSE(close(s) == 0, ESP_FAIL, TAG, "socket close failed (%d)", errno);
+  return ESP_OK;
+}
+
+//==============================================================================
+
 esp_err_t NetworkStream::SetSocketOption(int level, int option, int value) {
   LockGuard lg(*this);
   if (sock < 0)
@@ -229,25 +505,55 @@ esp_err_t NetworkStream::SetSocketOption(int level, int option, int value) {
 
 //==============================================================================
 
-NetworkEndpoint NetworkStream::SockAddrToEndpoint(sockaddr_storage& sockAddr) {
-  switch (((sockaddr*)&sockAddr)->sa_family) {
+NetworkEndpoint NetworkStream::SockAddrToEndpoint(const sockaddr_storage& sockAddr) {
+  switch (((const sockaddr*)&sockAddr)->sa_family) {
     case AF_INET:
-      return NetworkEndpoint(IpV4Address(((sockaddr_in*)&sockAddr)->sin_addr.s_addr), ntohs(((sockaddr_in*)&sockAddr)->sin_port));
+      return NetworkEndpoint(IpV4Address(((const sockaddr_in*)&sockAddr)->sin_addr.s_addr), ntohs(((const sockaddr_in*)&sockAddr)->sin_port));
     case AF_INET6:
-      uint32_t* u32 = ((sockaddr_in6*)&sockAddr)->sin6_addr.un.u32_addr;
+      uint32_t u32[4];
+      memcpy(u32, &((const sockaddr_in6*)&sockAddr)->sin6_addr, sizeof(u32));
       if (u32[0] == 0 && u32[1] == 0 && u32[2] == 0xFFFF0000)
-        return NetworkEndpoint(IpV4Address(u32[3]), ntohs(((sockaddr_in*)&sockAddr)->sin_port));
+        return NetworkEndpoint(IpV4Address(u32[3]), ntohs(((const sockaddr_in6*)&sockAddr)->sin6_port));
       else
-        return NetworkEndpoint(IpV6Address(
-          ((sockaddr_in6*)&sockAddr)->sin6_addr.un.u32_addr[0],
-          ((sockaddr_in6*)&sockAddr)->sin6_addr.un.u32_addr[1],
-          ((sockaddr_in6*)&sockAddr)->sin6_addr.un.u32_addr[2],
-          ((sockaddr_in6*)&sockAddr)->sin6_addr.un.u32_addr[3],
-          ((sockaddr_in6*)&sockAddr)->sin6_scope_id), ntohs(((sockaddr_in6*)&sockAddr)->sin6_port));
+        return NetworkEndpoint(IpV6Address(u32[0], u32[1], u32[2], u32[3], ((const sockaddr_in6*)&sockAddr)->sin6_scope_id),
+          ntohs(((const sockaddr_in6*)&sockAddr)->sin6_port));
   }
   return NetworkEndpoint();
 }
 
 //==============================================================================
 
+size_t NetworkStream::WaitForTokens(TokenBucket& tokenBucket, size_t size) {
+  if (!tokenBucket.IsLimited())
+    return size;
+
+  // Wait until at least one token is available and limit the transfer size to the available tokens.
+  // Shared token buckets are not waited for: the transfer takes their tokens in advance and GetReadableSize hides the data until they are refilled.
+  while (true) {
+    size_t availableSize = std::min<size_t>(size, tokenBucket.GetAvailableTokens());
+    if (availableSize)
+      return availableSize;
+    vTaskDelay(std::max<TickType_t>(tokenBucket.GetRefillTime() / 1000 / portTICK_PERIOD_MS, 1));
+  }
+}
+
+//==============================================================================
+
+int64_t NetworkStream::GetSharedTokenRefillTime() {
+  int64_t refillTime = sharedReadTokenBucket ? sharedReadTokenBucket->GetRefillTime() : 0;
+  if (sharedWriteTokenBucket)
+    refillTime = std::max(refillTime, sharedWriteTokenBucket->GetRefillTime());
+  return refillTime;
+}
+
+//==============================================================================
+
+void NetworkStream::TakeTokens(TokenBucket& tokenBucket, SharedTokenBucket* sharedTokenBucket, size_t size) {
+  tokenBucket.Take(size);
+  if (sharedTokenBucket)
+    sharedTokenBucket->Take(size);
+}
+
+//==============================================================================
+
 }
\ No newline at end of file
@@ -0,0 +1,101 @@
+#include "pl_network_stream_pool.h"
+#include "esp_check.h"
+
+//==============================================================================
+
+static const char* TAG = "pl_network_stream_pool";
+
+//==============================================================================
+
+namespace PL {
+
+//==============================================================================
+
+NetworkStreamPool::NetworkStreamPool(size_t size) {
+  SetSize(size);
+}
+
+//==============================================================================
+
+esp_err_t NetworkStreamPool::Lock(TickType_t timeout) {
+  esp_err_t error = mutex.Lock(timeout);
+  if (error == ESP_OK)
+    return ESP_OK;
+  if (error == ESP_ERR_TIMEOUT && timeout == 0)
+    return ESP_ERR_TIMEOUT;
+  ESP_RETURN_ON_ERROR(error, TAG, "mutex lock failed");
+  return ESP_OK;
+}
+
+//==============================================================================
+
+esp_err_t NetworkStreamPool::Unlock() {
+  ESP_RETURN_ON_ERROR(mutex.Unlock(), TAG, "mutex unlock failed");
+  return ESP_OK;
+}
+
+//==============================================================================
+
+std::shared_ptr<NetworkStream> NetworkStreamPool::Open(int sock) {
+  LockGuard lg(*this);
+  for (auto& stream : streams) {
+    if (IsFree(stream))
+      return stream->Open(sock) == ESP_OK ? stream : nullptr;
+  }
+  return nullptr;
+}
+
+//==============================================================================
+
+size_t NetworkStreamPool::GetSize() {
+  LockGuard lg(*this);
+  return streams.size();
+}
+
+//==============================================================================
+
+esp_err_t NetworkStreamPool::SetSize(size_t size) {
+  LockGuard lg(*this);
+  for (auto stream = streams.begin(); stream != streams.end() && streams.size() > size;)
+    stream = IsFree(*stream) ? streams.erase(stream) : stream + 1;
+  if (streams.size() > size)
+    streams.resize(size);
+
+  streams.reserve(size);
+  while (streams.size() < size)
+    streams.push_back(std::make_shared<NetworkStream>());
+  return ESP_OK;
+}
+
+//==============================================================================
+
+esp_err_t NetworkStreamPool::SetStreams(NetworkStream* streams, size_t size) {
+  LockGuard lg(*this);
+  ESP_RETURN_ON_FALSE(streams || !size, ESP_ERR_INVALID_ARG, TAG, "streams are null");
+  this->streams.clear();
+  this->streams.reserve(size);
+  for (size_t i = 0; i < size; i++)
+    this->streams.push_back(std::shared_ptr<NetworkStream>(streams + i, [](NetworkStream*) {}));
+  return ESP_OK;
+}
+
+//==============================================================================
+
+size_t NetworkStreamPool::GetNumberOfFreeStreams() {
+  LockGuard lg(*this);
+  size_t numberOfFreeStreams = 0;
+  for (auto& stream : streams)
+    numberOfFreeStreams += IsFree(stream);
+  return numberOfFreeStreams;
+}
+
+//==============================================================================
+
+bool NetworkStreamPool::IsFree(const std::shared_ptr<NetworkStream>& stream) {
+  // The pool holds the only reference, so the stream cannot be referenced concurrently
+  return stream.use_count() == 1 && !stream->IsOpen();
+}
+
+//==============================================================================
+
+}
\ No newline at end of file
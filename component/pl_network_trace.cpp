@@ -0,0 +1,109 @@
+#include "pl_network_trace.h"
+
+#if CONFIG_PL_NETWORK_TRACE
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "pl_network_platform.h"
+#include <algorithm>
+#include <atomic>
+#include <vector>
+#if CONFIG_PL_NETWORK_TRACE_SYSVIEW
+#include "SEGGER_SYSVIEW.h"
+#endif
+
+//==============================================================================
+
+static PL::NetworkTraceRecord records[portNUM_PROCESSORS][PL::NetworkTrace::bufferSize];
+static std::atomic<uint32_t> recordCounters[portNUM_PROCESSORS];
+
+//==============================================================================
+
+namespace PL {
+
+//==============================================================================
+
+void NetworkTrace::Add(NetworkTraceEvent event, const void* object, uint32_t value) {
+  int coreId = xPortGetCoreID();
+  // The slot is claimed atomically, so the tasks that preempt each other on the same core write different records
+  NetworkTraceRecord& record = records[coreId][recordCounters[coreId].fetch_add(1, std::memory_order_relaxed) % bufferSize];
+  record.time = GetTimeInMicroseconds();
+  record.task = xTaskGetCurrentTaskHandle();
+  record.object = object;
+  record.value = value;
+  record.event = event;
+
+#if CONFIG_PL_NETWORK_TRACE_SYSVIEW
+  switch (event) {
+    case NetworkTraceEvent::handleRequestBegin:
+    case NetworkTraceEvent::readBegin:
+    case NetworkTraceEvent::writeBegin:
+    case NetworkTraceEvent::streamLockAcquired:
+    case NetworkTraceEvent::serverLockAcquired:
+      SEGGER_SYSVIEW_MarkStart((unsigned)event);
+      break;
+    case NetworkTraceEvent::handleRequestEnd:
+    case NetworkTraceEvent::readEnd:
+    case NetworkTraceEvent::writeEnd:
+    case NetworkTraceEvent::streamLockReleased:
+    case NetworkTraceEvent::serverLockReleased:
+      SEGGER_SYSVIEW_MarkStop((unsigned)event - 1);
+      break;
+    default:
+      SEGGER_SYSVIEW_Mark((unsigned)event);
+      break;
+  }
+#endif
+}
+
+//==============================================================================
+
+void NetworkTrace::Clear() {
+  for (int coreId = 0; coreId < portNUM_PROCESSORS; coreId++)
+    recordCounters[coreId].store(0, std::memory_order_relaxed);
+}
+
+//==============================================================================
+
+size_t NetworkTrace::Dump(FILE* file) {
+  std::vector<std::pair<int, NetworkTraceRecord>> sortedRecords;
+  for (int coreId = 0; coreId < portNUM_PROCESSORS; coreId++) {
+    uint32_t counter = recordCounters[coreId].load(std::memory_order_relaxed);
+    for (uint32_t i = counter > bufferSize ? counter - bufferSize : 0; i < counter; i++)
+      sortedRecords.push_back({coreId, records[coreId][i % bufferSize]});
+  }
+  std::stable_sort(sortedRecords.begin(), sortedRecords.end(), [](auto& r1, auto& r2) { return r1.second.time < r2.second.time; });
+
+  fprintf(file, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+  for (size_t i = 0; i < sortedRecords.size(); i++) {
+    NetworkTraceRecord& record = sortedRecords[i].second;
+    const char* name;
+    const char* phase;
+    switch (record.event) {
+      case NetworkTraceEvent::accept: name = "Accept"; phase = "i"; break;
+      case NetworkTraceEvent::readable: name = "Readable"; phase = "i"; break;
+      case NetworkTraceEvent::handleRequestBegin: name = "HandleRequest"; phase = "B"; break;
+      case NetworkTraceEvent::handleRequestEnd: name = "HandleRequest"; phase = "E"; break;
+      case NetworkTraceEvent::readBegin: name = "Read"; phase = "B"; break;
+      case NetworkTraceEvent::readEnd: name = "Read"; phase = "E"; break;
+      case NetworkTraceEvent::writeBegin: name = "Write"; phase = "B"; break;
+      case NetworkTraceEvent::writeEnd: name = "Write"; phase = "E"; break;
+      case NetworkTraceEvent::streamLockAcquired: name = "NetworkStream lock"; phase = "B"; break;
+      case NetworkTraceEvent::streamLockReleased: name = "NetworkStream lock"; phase = "E"; break;
+      case NetworkTraceEvent::serverLockAcquired: name = "TcpServer lock"; phase = "B"; break;
+      case NetworkTraceEvent::serverLockReleased: name = "TcpServer lock"; phase = "E"; break;
+      default: name = "Unknown"; phase = "i"; break;
+    }
+    fprintf(file, "%s\n{\"name\":\"%s\",\"ph\":\"%s\",%s\"ts\":%lld,\"pid\":%d,\"tid\":%lu,\"args\":{\"object\":\"%p\",\"value\":%lu}}",
+      i ? "," : "", name, phase, phase[0] == 'i' ? "\"s\":\"t\"," : "", (long long)record.time, sortedRecords[i].first,
+      (unsigned long)(uintptr_t)record.task, record.object, (unsigned long)record.value);
+  }
+  fprintf(file, "\n]}\n");
+  return sortedRecords.size();
+}
+
+//==============================================================================
+
+}
+
+#endif
\ No newline at end of file
@@ -1,5 +1,7 @@
 #include "pl_network_types.h"
-#include "lwip/sockets.h"
+#include "pl_network_platform.h"
+#include <algorithm>
+#include <stdlib.h>
 
 //==============================================================================
 
@@ -114,7 +116,14 @@ IpV6Address::IpV6Address(uint32_t u32_0, uint32_t u32_1, uint32_t u32_2, uint32_
 
 IpV6Address::IpV6Address(const std::string& address) {
   u32[0] = u32[1] = u32[2] = u32[3] = zoneId = 0;
-  inet_pton(AF_INET6, address.c_str(), &u32);
+  size_t zoneIdIndex = address.find('%');
+  if (zoneIdIndex == std::string::npos) {
+    inet_pton(AF_INET6, address.c_str(), &u32);
+    return;
+  }
+  // Numeric zone ID suffix as produced by ToString
+  if (inet_pton(AF_INET6, address.substr(0, zoneIdIndex).c_str(), &u32) == 1)
+    zoneId = (uint8_t)strtoul(address.c_str() + zoneIdIndex + 1, NULL, 10);
 }
 
 //==============================================================================
@@ -163,6 +172,25 @@ std::string NetworkAddress::ToString() const {
 
 //==============================================================================
 
+bool NetworkAddress::operator==(const NetworkAddress& address) const {
+  if (family != address.family)
+    return false;
+  if (family == NetworkAddressFamily::ipV4)
+    return ipV4.u32 == address.ipV4.u32;
+  if (family == NetworkAddressFamily::ipV6)
+    return ipV6.u32[0] == address.ipV6.u32[0] && ipV6.u32[1] == address.ipV6.u32[1] && ipV6.u32[2] == address.ipV6.u32[2] &&
+           ipV6.u32[3] == address.ipV6.u32[3] && ipV6.zoneId == address.ipV6.zoneId;
+  return true;
+}
+
+//==============================================================================
+
+bool NetworkAddress::operator!=(const NetworkAddress& address) const {
+  return !(*this == address);
+}
+
+//==============================================================================
+
 NetworkEndpoint::NetworkEndpoint() : address(), port(0) {}
 
 //==============================================================================
@@ -175,4 +203,48 @@ NetworkEndpoint::NetworkEndpoint(IpV6Address address, uint16_t port) : address(a
 
 //==============================================================================
 
+NetworkAddressPrefix::NetworkAddressPrefix() : address(), length(0) {}
+
+//==============================================================================
+
+NetworkAddressPrefix::NetworkAddressPrefix(IpV4Address address, uint8_t length) : address(address), length(std::min<uint8_t>(length, 32)) {}
+
+//==============================================================================
+
+NetworkAddressPrefix::NetworkAddressPrefix(IpV6Address address, uint8_t length) : address(address), length(std::min<uint8_t>(length, 128)) {}
+
+//==============================================================================
+
+bool NetworkAddressPrefix::Contains(const NetworkAddress& address) const {
+  if (address.family != this->address.family)
+    return false;
+
+  const uint8_t* prefixBytes;
+  const uint8_t* addressBytes;
+  if (address.family == NetworkAddressFamily::ipV4) {
+    prefixBytes = this->address.ipV4.u8;
+    addressBytes = address.ipV4.u8;
+  }
+  else if (address.family == NetworkAddressFamily::ipV6) {
+    prefixBytes = this->address.ipV6.u8;
+    addressBytes = address.ipV6.u8;
+  }
+  else
+    return false;
+
+  int i = 0;
+  for (; i < length / 8; i++) {
+    if (prefixBytes[i] != addressBytes[i])
+      return false;
+  }
+  if (length % 8) {
+    uint8_t mask = 0xFF << (8 - length % 8);
+    if ((prefixBytes[i] & mask) != (addressBytes[i] & mask))
+      return false;
+  }
+  return true;
 }
+
+//==============================================================================
+
+}
\ No newline at end of file
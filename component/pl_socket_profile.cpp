@@ -0,0 +1,55 @@
+#include "pl_socket_profile.h"
+#include "sdkconfig.h"
+#include "esp_check.h"
+
+//==============================================================================
+
+static const char* TAG = "pl_socket_profile";
+
+//==============================================================================
+
+namespace PL {
+
+//==============================================================================
+
+SocketProfile SocketProfile::Control() {
+  SocketProfile profile;
+  profile.nagleAlgorithmEnabled = false;
+  profile.keepAliveEnabled = true;
+  profile.keepAliveIdleTime = 30;
+  profile.keepAliveInterval = 10;
+  profile.keepAliveCount = 3;
+  // Expedited Forwarding
+  profile.dscp = 46;
+  return profile;
+}
+
+//==============================================================================
+
+SocketProfile SocketProfile::Bulk() {
+  SocketProfile profile;
+  profile.nagleAlgorithmEnabled = true;
+  // Lower-effort per-hop behavior (RFC 8622)
+  profile.dscp = 1;
+  return profile;
+}
+
+//==============================================================================
+
+esp_err_t SocketProfile::Validate(const SocketProfile& profile) {
+  ESP_RETURN_ON_FALSE(profile.dscp <= maxDscp, ESP_ERR_INVALID_ARG, TAG, "invalid DSCP");
+#if !CONFIG_IDF_TARGET_LINUX
+  ESP_RETURN_ON_FALSE(profile.sendBufferSize <= 0, ESP_ERR_NOT_SUPPORTED, TAG, "send buffer size is not supported by lwIP");
+#if !CONFIG_LWIP_SO_RCVBUF
+  ESP_RETURN_ON_FALSE(profile.receiveBufferSize <= 0, ESP_ERR_NOT_SUPPORTED, TAG, "receive buffer size requires CONFIG_LWIP_SO_RCVBUF");
+#endif
+#if !CONFIG_LWIP_SO_LINGER
+  ESP_RETURN_ON_FALSE(profile.lingerTime < 0, ESP_ERR_NOT_SUPPORTED, TAG, "linger requires CONFIG_LWIP_SO_LINGER");
+#endif
+#endif
+  return ESP_OK;
+}
+
+//==============================================================================
+
+}
\ No newline at end of file
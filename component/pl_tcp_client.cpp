@@ -1,5 +1,5 @@
 #include "pl_tcp_client.h"
-#include "lwip/sockets.h"
+#include "pl_network_platform.h"
 #include "esp_check.h"
 
 //==============================================================================
@@ -63,7 +63,7 @@ esp_err_t TcpClient::Connect() {
       connected = (connect(sock, (sockaddr*)&sockAddr, sizeof(sockAddr)) == 0);
     }
     else {
-      sockaddr_in6 sockAddr;
+      sockaddr_in6 sockAddr = {};
       sockAddr.sin6_family = addressFamily;
       ((uint32_t*)&sockAddr.sin6_addr)[0] = remoteEndpoint.address.ipV6.u32[0];
       ((uint32_t*)&sockAddr.sin6_addr)[1] = remoteEndpoint.address.ipV6.u32[1];
@@ -75,9 +75,14 @@ esp_err_t TcpClient::Connect() {
     }
 
     if (connected) {
-      stream = std::make_shared<NetworkStream>(sock);
-      ESP_RETURN_ON_ERROR((nagleAlgorithmEnabled ? stream->EnableNagleAlgorithm() : stream->DisableNagleAlgorithm()), TAG, "Nagle's algorithm set failed");
-      ESP_RETURN_ON_ERROR(stream->SetReadTimeout(readTimeout), TAG, "read timeout set failed");
+      // The stream object is reused unless it is still referenced outside the client
+      if (stream.use_count() > 1 || stream->Open(sock) != ESP_OK)
+        stream = std::make_shared<NetworkStream>(sock);
+      // The connection is not left open with the socket options that the client did not ask for
+      if (stream->SetSocketProfile(socketProfile) != ESP_OK || stream->SetReadTimeout(readTimeout) != ESP_OK) {
+        stream->Close();
+        ESP_RETURN_ON_ERROR(ESP_FAIL, TAG, "socket configuration failed");
+      }
       return ESP_OK;
     }
     close(sock);
@@ -98,7 +103,7 @@ esp_err_t TcpClient::Disconnect() {
 
 esp_err_t TcpClient::EnableNagleAlgorithm() {
   LockGuard lg(*this);
-  this->nagleAlgorithmEnabled = true;
+  socketProfile.nagleAlgorithmEnabled = true;
   ESP_RETURN_ON_ERROR(stream->EnableNagleAlgorithm(), TAG, "Nagle's algorithm enable failed");
   return ESP_OK;
 }
@@ -107,13 +112,30 @@ esp_err_t TcpClient::EnableNagleAlgorithm() {
 
 esp_err_t TcpClient::DisableNagleAlgorithm() {
   LockGuard lg(*this);
-  this->nagleAlgorithmEnabled = false;
+  socketProfile.nagleAlgorithmEnabled = false;
   ESP_RETURN_ON_ERROR(stream->DisableNagleAlgorithm(), TAG, "Nagle's algorithm disable failed");
   return ESP_OK;
 }
 
 //==============================================================================
 
+SocketProfile TcpClient::GetSocketProfile() {
+  LockGuard lg(*this);
+  return socketProfile;
+}
+
+//==============================================================================
+
+esp_err_t TcpClient::SetSocketProfile(const SocketProfile& profile) {
+  LockGuard lg(*this);
+  ESP_RETURN_ON_ERROR(SocketProfile::Validate(profile), TAG, "invalid socket profile");
+  socketProfile = profile;
+  ESP_RETURN_ON_ERROR(stream->SetSocketProfile(profile), TAG, "socket profile set failed");
+  return ESP_OK;
+}
+
+//==============================================================================
+
 bool TcpClient::IsConnected() {
   LockGuard lg(*this);
   return stream->IsOpen();
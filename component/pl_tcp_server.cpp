@@ -1,6 +1,9 @@
 #include "pl_tcp_server.h"
-#include "lwip/sockets.h"
+#include "pl_tcp_server_host.h"
+#include "pl_network_platform.h"
+#include "pl_network_trace.h"
 #include "esp_check.h"
+#include <algorithm>
 
 //==============================================================================
 
@@ -13,28 +16,60 @@ namespace PL {
 //==============================================================================
 
 const TaskParameters TcpServer::defaultTaskParameters = {4096, tskIDLE_PRIORITY + 5, 0};
+const TaskParameters TcpServer::defaultEventDispatcherTaskParameters = {3072, tskIDLE_PRIORITY + 1, 0};
 
 //==============================================================================
 
-TcpServer::TcpServer(uint16_t port) : clientConnectedEvent(*this), clientDisconnectedEvent(*this), port(port) {}
+TcpServer::TcpServer(uint16_t port) : clientConnectedEvent(*this), clientDisconnectedEvent(*this), clientStreamPool(defaultMaxNumberOfClients),
+    readTokenBucket(std::make_shared<SharedTokenBucket>()), writeTokenBucket(std::make_shared<SharedTokenBucket>()) {
+  // No configuration readers exist yet
+  CopyConfiguration()->port = port;
+  StoreConfiguration();
+  clientStreams.reserve(defaultMaxNumberOfClients);
+  PublishClientStreams();
+  ReservePendingClientEvents(defaultMaxNumberOfClients);
+  taskStoppedSemaphore = xSemaphoreCreateBinaryStatic(&taskStoppedSemaphoreBuffer);
+  xSemaphoreGive(taskStoppedSemaphore);
+  taskWakeSemaphore = xSemaphoreCreateBinaryStatic(&taskWakeSemaphoreBuffer);
+  drainedSemaphore = xSemaphoreCreateBinaryStatic(&drainedSemaphoreBuffer);
+  eventDispatcherStoppedSemaphore = xSemaphoreCreateBinaryStatic(&eventDispatcherStoppedSemaphoreBuffer);
+  xSemaphoreGive(eventDispatcherStoppedSemaphore);
+  eventDispatcherWakeSemaphore = xSemaphoreCreateBinaryStatic(&eventDispatcherWakeSemaphoreBuffer);
+}
 
 //==============================================================================
 
 TcpServer::~TcpServer() {
-  while (taskHandle) {
-    disable = true;
-    vTaskDelay(1);
-  }
+  Lock();
+  StopTask();
+  Unlock();
+  // The task can still be finishing after the disable from the request handler
+  xSemaphoreTake(taskStoppedSemaphore, portMAX_DELAY);
+  DeleteStaticTask();
+  if (wakeSock >= 0)
+    close(wakeSock);
+  if (host)
+    host->DetachServer(*this);
+  StopEventDispatcher(portMAX_DELAY);
   for (auto& clientStream : clientStreams)
     clientStream->Close();
+  if (listenSock >= 0)
+    close(listenSock);
+  vSemaphoreDelete(eventDispatcherWakeSemaphore);
+  vSemaphoreDelete(eventDispatcherStoppedSemaphore);
+  vSemaphoreDelete(drainedSemaphore);
+  vSemaphoreDelete(taskWakeSemaphore);
+  vSemaphoreDelete(taskStoppedSemaphore);
 }
 
 //==============================================================================
 
 esp_err_t TcpServer::Lock(TickType_t timeout) {
   esp_err_t error = mutex.Lock(timeout);
-  if (error == ESP_OK)
+  if (error == ESP_OK) {
+    PL_NETWORK_TRACE(serverLockAcquired, this, 0);
     return ESP_OK;
+  }
   if (error == ESP_ERR_TIMEOUT && timeout == 0)
     return ESP_ERR_TIMEOUT;
   ESP_RETURN_ON_ERROR(error, TAG, "mutex lock failed");
@@ -44,6 +79,7 @@ esp_err_t TcpServer::Lock(TickType_t timeout) {
 //==============================================================================
 
 esp_err_t TcpServer::Unlock() {
+  PL_NETWORK_TRACE(serverLockReleased, this, 0);
   ESP_RETURN_ON_ERROR(mutex.Unlock(), TAG, "mutex unlock failed");
   return ESP_OK;
 }
@@ -52,18 +88,22 @@ esp_err_t TcpServer::Unlock() {
 
 esp_err_t TcpServer::Enable() {
   LockGuard lg(*this);
-  if (taskHandle == xTaskGetCurrentTaskHandle()) {
+  if (taskHandle == xTaskGetCurrentTaskHandle() || pollingTaskHandle == xTaskGetCurrentTaskHandle()) {
     enableFromRequest = true;
     return ESP_OK;
   }
-  if (taskHandle)
+  // The task of the Disable that timed out is still stopping: Disable completes the stop
+  ESP_RETURN_ON_FALSE(!taskHandle || !disable, ESP_ERR_INVALID_STATE, TAG, "server task is stopping");
+  if (taskHandle || manuallyEnabled)
     return ESP_OK;
   
-  disable = false;
-  if (xTaskCreatePinnedToCore(TaskCode, GetName().c_str(), taskParameters.stackDepth, this, taskParameters.priority, &taskHandle, taskParameters.coreId) != pdPASS) {
-    taskHandle = NULL;
-    ESP_RETURN_ON_ERROR(ESP_FAIL, TAG, "task create failed");
+  if (manualPolling) {
+    disable = false;
+    manuallyEnabled = true;
   }
+  else
+    ESP_RETURN_ON_ERROR(StartTask(), TAG, "task start failed");
+  enabled = true;
   enabledEvent.Generate();
   return ESP_OK;
 }
@@ -72,24 +112,59 @@ esp_err_t TcpServer::Enable() {
 
 esp_err_t TcpServer::Disable() {
   LockGuard lg(*this);
-  if (taskHandle == xTaskGetCurrentTaskHandle()) {
+  if (taskHandle == xTaskGetCurrentTaskHandle() || pollingTaskHandle == xTaskGetCurrentTaskHandle()) {
     enableFromRequest = false;
     disableFromRequest = true;
     return ESP_OK;
   }
-  if (!taskHandle)
+  if (!IsEnabled())
     return ESP_OK;
   
-  while (taskHandle) {
-    disable = true;
-    vTaskDelay(1);
+  ESP_RETURN_ON_ERROR(StopTask(), TAG, "task stop failed");
+  // The server can be disabled by another task or by the request handler while the server is unlocked in StopTask
+  if (IsEnabled())
+    Stop();
+  return ESP_OK;
+}
+
+//==============================================================================
+
+esp_err_t TcpServer::Drain(TickType_t timeout) {
+  {
+    LockGuard lg(*this);
+    ESP_RETURN_ON_FALSE(taskHandle != xTaskGetCurrentTaskHandle() && pollingTaskHandle != xTaskGetCurrentTaskHandle(), ESP_ERR_INVALID_STATE, TAG,
+                        "server cannot be drained from the request handler");
+    if (!IsEnabled())
+      return ESP_OK;
+
+    // New connections are refused while the connected clients finish
+    draining = true;
+    xSemaphoreTake(drainedSemaphore, 0);
+    if (listenSock >= 0) {
+      close(listenSock);
+      listenSock = -1;
+    }
+    // HandleDrain is called by the server task, so that the client streams are locked after the server as in the request handling
+    drainRequested = true;
+    WakeTask();
   }
 
-  for (auto& clientStream : clientStreams)
-    clientStream->Close();
-  clientStreams.clear();
+  if (manualPolling) {
+    for (TickType_t startTime = xTaskGetTickCount(), time = startTime; GetClientStreams().size() && time - startTime < timeout; time = xTaskGetTickCount()) {
+      if (Poll(timeout - (time - startTime)) != ESP_OK)
+        break;
+    }
+  }
+  else if (GetClientStreams().size())
+    xSemaphoreTake(drainedSemaphore, timeout);
 
-  disabledEvent.Generate();
+  ESP_RETURN_ON_ERROR(Disable(), TAG, "disable failed");
+  return ESP_OK;
+}
+
+//==============================================================================
+
+esp_err_t TcpServer::HandleDrain(NetworkStream& clientStream) {
   return ESP_OK;
 }
 
@@ -97,8 +172,11 @@ esp_err_t TcpServer::Disable() {
 
 esp_err_t TcpServer::EnableNagleAlgorithm() {
   LockGuard lg(*this);
-  this->nagleAlgorithmEnabled = true;
-  ESP_RETURN_ON_ERROR(SetStreamSocketOptions(), TAG, "stream socket options set failed");
+  auto configuration = CopyConfiguration();
+  ESP_RETURN_ON_FALSE(configuration, ESP_ERR_INVALID_STATE, TAG, "configuration is read by the current task");
+  configuration->socketProfile.nagleAlgorithmEnabled = true;
+  StoreConfiguration();
+  ESP_RETURN_ON_ERROR(ApplySocketProfile(), TAG, "socket profile apply failed");
   return ESP_OK;
 }
 
@@ -106,8 +184,11 @@ esp_err_t TcpServer::EnableNagleAlgorithm() {
 
 esp_err_t TcpServer::DisableNagleAlgorithm() {
   LockGuard lg(*this);
-  this->nagleAlgorithmEnabled = false;
-  ESP_RETURN_ON_ERROR(SetStreamSocketOptions(), TAG, "stream socket options set failed");
+  auto configuration = CopyConfiguration();
+  ESP_RETURN_ON_FALSE(configuration, ESP_ERR_INVALID_STATE, TAG, "configuration is read by the current task");
+  configuration->socketProfile.nagleAlgorithmEnabled = false;
+  StoreConfiguration();
+  ESP_RETURN_ON_ERROR(ApplySocketProfile(), TAG, "socket profile apply failed");
   return ESP_OK;
 }
 
@@ -115,8 +196,11 @@ esp_err_t TcpServer::DisableNagleAlgorithm() {
 
 esp_err_t TcpServer::EnableKeepAlive() {
   LockGuard lg(*this);
-  this->keepAliveEnabled = true;
-  ESP_RETURN_ON_ERROR(SetStreamSocketOptions(), TAG, "stream socket options set failed");
+  auto configuration = CopyConfiguration();
+  ESP_RETURN_ON_FALSE(configuration, ESP_ERR_INVALID_STATE, TAG, "configuration is read by the current task");
+  configuration->socketProfile.keepAliveEnabled = true;
+  StoreConfiguration();
+  ESP_RETURN_ON_ERROR(ApplySocketProfile(), TAG, "socket profile apply failed");
   return ESP_OK;
 }
 
@@ -124,8 +208,11 @@ esp_err_t TcpServer::EnableKeepAlive() {
 
 esp_err_t TcpServer::DisableKeepAlive() {
   LockGuard lg(*this);
-  this->keepAliveEnabled = false;
-  ESP_RETURN_ON_ERROR(SetStreamSocketOptions(), TAG, "stream socket options set failed");
+  auto configuration = CopyConfiguration();
+  ESP_RETURN_ON_FALSE(configuration, ESP_ERR_INVALID_STATE, TAG, "configuration is read by the current task");
+  configuration->socketProfile.keepAliveEnabled = false;
+  StoreConfiguration();
+  ESP_RETURN_ON_ERROR(ApplySocketProfile(), TAG, "socket profile apply failed");
   return ESP_OK;
 }
 
@@ -133,55 +220,216 @@ esp_err_t TcpServer::DisableKeepAlive() {
 //==============================================================================
 
 bool TcpServer::IsEnabled() {
-  LockGuard lg(*this);
-  return taskHandle;
+  return enabled;
 }
 
 //==============================================================================
 
 uint16_t TcpServer::GetPort() {
-  LockGuard lg(*this);
-  return port;
+  return GetConfiguration()->port;
 }
 
 //==============================================================================
 
 esp_err_t TcpServer::SetPort(uint16_t port) {
   LockGuard lg(*this);
-  this->port = port;
-  ESP_RETURN_ON_ERROR(RestartIfEnabled(), TAG, "restart failed");
+  if (port == GetConfiguration()->port)
+    return ESP_OK;
+  auto configuration = CopyConfiguration();
+  ESP_RETURN_ON_FALSE(configuration, ESP_ERR_INVALID_STATE, TAG, "configuration is read by the current task");
+  configuration->port = port;
+  StoreConfiguration();
+
+  // The new listening socket is opened before the old one is closed, so that the connected clients are kept
+  if (listenSock >= 0 && !disable) {
+    int newListenSock = Listen();
+    if (newListenSock < 0) {
+      // The previous configuration is still in the inactive buffer
+      StoreConfiguration();
+      ESP_RETURN_ON_ERROR(ESP_FAIL, TAG, "listen failed");
+    }
+    close(listenSock);
+    listenSock = newListenSock;
+    WakeTask();
+  }
   return ESP_OK;
 }
 
 //==============================================================================
 
 size_t TcpServer::GetMaxNumberOfClients() {
-  LockGuard lg(*this);
-  return maxNumberOfClients;
+  return GetConfiguration()->maxNumberOfClients;
 }
 
 //==============================================================================
 
 esp_err_t TcpServer::SetMaxNumberOfClients(size_t maxNumberOfClients) {
   LockGuard lg(*this);
-  this->maxNumberOfClients = maxNumberOfClients;
-  ESP_RETURN_ON_ERROR(RestartIfEnabled(), TAG, "restart failed");
+  if (numberOfStaticClientStreams)
+    ESP_RETURN_ON_FALSE(maxNumberOfClients <= numberOfStaticClientStreams, ESP_ERR_INVALID_ARG, TAG, "maximum number of clients exceeds the number of static client streams");
+  else
+    ESP_RETURN_ON_ERROR(clientStreamPool.SetSize(maxNumberOfClients), TAG, "client stream pool size set failed");
+  ESP_RETURN_ON_ERROR(ReservePendingClientEvents(maxNumberOfClients), TAG, "pending client events reserve failed");
+  auto configuration = CopyConfiguration();
+  ESP_RETURN_ON_FALSE(configuration, ESP_ERR_INVALID_STATE, TAG, "configuration is read by the current task");
+  configuration->maxNumberOfClients = maxNumberOfClients;
+  StoreConfiguration();
+  clientStreams.reserve(maxNumberOfClients);
+  PublishClientStreams();
+  // Connected clients above the new limit are kept. The listen backlog of the open listening socket is changed in place.
+  if (listenSock >= 0)
+    listen(listenSock, maxNumberOfClients);
+  // The task waits for the new connections if the new limit allows more clients
+  WakeTask();
   return ESP_OK;
 }
 
 //==============================================================================
 
 std::vector<std::shared_ptr<NetworkStream>> TcpServer::GetClientStreams() {
-  LockGuard lg(*this);
-  return clientStreams;  
+  Snapshot<std::vector<std::shared_ptr<NetworkStream>>>::Reader clientStreams(publishedClientStreams);
+  return *clientStreams;
 }
 
 //==============================================================================
 
 esp_err_t TcpServer::SetTaskParameters(const TaskParameters& taskParameters) {
   LockGuard lg(*this);
+  TaskParameters previousTaskParameters = this->taskParameters;
   this->taskParameters = taskParameters;
-  ESP_RETURN_ON_ERROR(RestartIfEnabled(), TAG, "restart failed");
+  if (staticTaskHandle)
+    vTaskPrioritySet(staticTaskHandle, taskParameters.priority);
+  if (!taskHandle || host || staticTaskHandle)
+    return ESP_OK;
+
+  // The priority is changed in place. The task is recreated with the connections kept if the stack depth or the core is changed.
+  if (taskHandle == xTaskGetCurrentTaskHandle() ||
+      (taskParameters.stackDepth == previousTaskParameters.stackDepth && taskParameters.coreId == previousTaskParameters.coreId)) {
+    vTaskPrioritySet(taskHandle, taskParameters.priority);
+    return ESP_OK;
+  }
+  ESP_RETURN_ON_ERROR(StopTask(), TAG, "task stop failed");
+  // The server can be disabled by another task or by the request handler while the server is unlocked in StopTask
+  if (!IsEnabled())
+    return ESP_OK;
+  if (esp_err_t error = StartTask()) {
+    Stop();
+    ESP_RETURN_ON_ERROR(error, TAG, "task start failed");
+  }
+  return ESP_OK;
+}
+
+//==============================================================================
+
+esp_err_t TcpServer::SetHost(TcpServerHost* host) {
+  LockGuard lg(*this);
+  ESP_RETURN_ON_FALSE(!IsEnabled(), ESP_ERR_INVALID_STATE, TAG, "server is enabled");
+  // The host keeps the servers attached to it, so that it can disable and detach them when it is destroyed
+  if (this->host)
+    this->host->DetachServer(*this);
+  this->host = host;
+  if (host)
+    host->AttachServer(*this);
+  return ESP_OK;
+}
+
+//==============================================================================
+
+esp_err_t TcpServer::EnableManualPolling() {
+  LockGuard lg(*this);
+  ESP_RETURN_ON_FALSE(!IsEnabled(), ESP_ERR_INVALID_STATE, TAG, "server is enabled");
+  manualPolling = true;
+  return ESP_OK;
+}
+
+//==============================================================================
+
+esp_err_t TcpServer::DisableManualPolling() {
+  LockGuard lg(*this);
+  ESP_RETURN_ON_FALSE(!IsEnabled(), ESP_ERR_INVALID_STATE, TAG, "server is enabled");
+  manualPolling = false;
+  return ESP_OK;
+}
+
+//==============================================================================
+
+esp_err_t TcpServer::Poll(TickType_t timeout) {
+  fd_set set;
+  FD_ZERO(&set);
+  int maxSock = -1;
+  {
+    LockGuard lg(*this);
+    ESP_RETURN_ON_FALSE(manualPolling, ESP_ERR_INVALID_STATE, TAG, "manual polling is disabled");
+    ESP_RETURN_ON_FALSE(manuallyEnabled, ESP_ERR_INVALID_STATE, TAG, "server is disabled");
+    if (listenSock < 0 && !draining)
+      ESP_RETURN_ON_FALSE((listenSock = Listen()) >= 0, ESP_FAIL, TAG, "listen failed");
+    if (listenSock >= 0 && clientStreams.size() < GetConfiguration()->maxNumberOfClients) {
+      FD_SET(listenSock, &set);
+      maxSock = listenSock;
+    }
+    for (auto& clientStream : clientStreams) {
+      if (clientStream->sock >= 0) {
+        FD_SET(clientStream->sock, &set);
+        maxSock = std::max(maxSock, clientStream->sock);
+      }
+    }
+  }
+
+  // The server is not locked while waiting, so that the other tasks can use it
+  if (timeout && maxSock >= 0) {
+    uint64_t timeoutMs = (uint64_t)timeout * portTICK_PERIOD_MS;
+    timeval selectTimeout = {};
+    selectTimeout.tv_sec = timeoutMs / 1000;
+    selectTimeout.tv_usec = timeoutMs % 1000 * 1000;
+    select(maxSock + 1, &set, NULL, NULL, timeout == portMAX_DELAY ? NULL : &selectTimeout);
+  }
+
+  {
+    LockGuard lg(*this);
+    if (!manuallyEnabled)
+      return ESP_OK;
+    pollingTaskHandle = xTaskGetCurrentTaskHandle();
+  }
+  Process();
+  LockGuard lg(*this);
+  pollingTaskHandle = NULL;
+  return ESP_OK;
+}
+
+//==============================================================================
+
+esp_err_t TcpServer::SetStaticTaskMemory(StackType_t* stack, uint32_t stackDepth, StaticTask_t* taskBuffer) {
+  LockGuard lg(*this);
+  ESP_RETURN_ON_FALSE(!IsEnabled(), ESP_ERR_INVALID_STATE, TAG, "server is enabled");
+  ESP_RETURN_ON_FALSE(!stack || (stackDepth && taskBuffer), ESP_ERR_INVALID_ARG, TAG, "invalid task memory");
+  DeleteStaticTask();
+  staticTaskStack = stack;
+  staticTaskStackDepth = stackDepth;
+  staticTaskBuffer = taskBuffer;
+  return ESP_OK;
+}
+
+//==============================================================================
+
+esp_err_t TcpServer::SetStaticClientStreams(NetworkStream* streams, size_t numberOfStreams) {
+  LockGuard lg(*this);
+  ESP_RETURN_ON_FALSE(!IsEnabled(), ESP_ERR_INVALID_STATE, TAG, "server is enabled");
+  ESP_RETURN_ON_FALSE(streams || !numberOfStreams, ESP_ERR_INVALID_ARG, TAG, "streams are null");
+  if (numberOfStreams) {
+    ESP_RETURN_ON_ERROR(clientStreamPool.SetStreams(streams, numberOfStreams), TAG, "client stream pool streams set failed");
+    auto configuration = CopyConfiguration();
+    ESP_RETURN_ON_FALSE(configuration, ESP_ERR_INVALID_STATE, TAG, "configuration is read by the current task");
+    configuration->maxNumberOfClients = numberOfStreams;
+    StoreConfiguration();
+  }
+  else if (numberOfStaticClientStreams) {
+    ESP_RETURN_ON_ERROR(clientStreamPool.SetStreams(NULL, 0), TAG, "client stream pool streams set failed");
+    ESP_RETURN_ON_ERROR(clientStreamPool.SetSize(GetConfiguration()->maxNumberOfClients), TAG, "client stream pool size set failed");
+  }
+  numberOfStaticClientStreams = numberOfStreams;
+  clientStreams.reserve(GetConfiguration()->maxNumberOfClients);
+  PublishClientStreams();
+  ESP_RETURN_ON_ERROR(ReservePendingClientEvents(GetConfiguration()->maxNumberOfClients), TAG, "pending client events reserve failed");
   return ESP_OK;
 }
 
@@ -189,18 +437,23 @@ esp_err_t TcpServer::SetTaskParameters(const TaskParameters& taskParameters) {
 
 esp_err_t TcpServer::SetKeepAliveIdleTime(int seconds) {
   LockGuard lg(*this);
-  this->keepAliveIdleTime = seconds;
-  ESP_RETURN_ON_ERROR(RestartIfEnabled(), TAG, "restart failed");
+  auto configuration = CopyConfiguration();
+  ESP_RETURN_ON_FALSE(configuration, ESP_ERR_INVALID_STATE, TAG, "configuration is read by the current task");
+  configuration->socketProfile.keepAliveIdleTime = seconds;
+  StoreConfiguration();
+  ESP_RETURN_ON_ERROR(ApplySocketProfile(), TAG, "socket profile apply failed");
   return ESP_OK;
-  return SetStreamSocketOptions();
 }
 
 //==============================================================================
 
 esp_err_t TcpServer::SetKeepAliveInterval(int seconds) {
   LockGuard lg(*this);
-  this->keepAliveInterval = seconds;
-  ESP_RETURN_ON_ERROR(SetStreamSocketOptions(), TAG, "stream socket options set failed");
+  auto configuration = CopyConfiguration();
+  ESP_RETURN_ON_FALSE(configuration, ESP_ERR_INVALID_STATE, TAG, "configuration is read by the current task");
+  configuration->socketProfile.keepAliveInterval = seconds;
+  StoreConfiguration();
+  ESP_RETURN_ON_ERROR(ApplySocketProfile(), TAG, "socket profile apply failed");
   return ESP_OK;
 }
 
@@ -208,115 +461,849 @@ esp_err_t TcpServer::SetKeepAliveInterval(int seconds) {
 
 esp_err_t TcpServer::SetKeepAliveCount(int count) {
   LockGuard lg(*this);
-  this->keepAliveCount = count;
-  ESP_RETURN_ON_ERROR(SetStreamSocketOptions(), TAG, "stream socket options set failed");
+  auto configuration = CopyConfiguration();
+  ESP_RETURN_ON_FALSE(configuration, ESP_ERR_INVALID_STATE, TAG, "configuration is read by the current task");
+  configuration->socketProfile.keepAliveCount = count;
+  StoreConfiguration();
+  ESP_RETURN_ON_ERROR(ApplySocketProfile(), TAG, "socket profile apply failed");
   return ESP_OK;
 }
 
 //==============================================================================
 
-esp_err_t TcpServer::SetStreamSocketOptions() {
-  esp_err_t error = ESP_OK;
-  for (auto& clientStream : clientStreams) {
-    error = (nagleAlgorithmEnabled ? clientStream->EnableNagleAlgorithm() : clientStream->DisableNagleAlgorithm()) == ESP_OK ? error : ESP_FAIL;
-    error = (keepAliveEnabled ? clientStream->EnableKeepAlive() : clientStream->DisableKeepAlive()) == ESP_OK ? error : ESP_FAIL;
-    error = clientStream->SetKeepAliveIdleTime(keepAliveIdleTime) == ESP_OK ? error : ESP_FAIL;
-    error = clientStream->SetKeepAliveInterval(keepAliveInterval) == ESP_OK ? error : ESP_FAIL;
-    error = clientStream->SetKeepAliveCount(keepAliveCount) == ESP_OK ? error : ESP_FAIL;
+esp_err_t TcpServer::AllowClients(const NetworkAddressPrefix& prefix) {
+  LockGuard lg(*this);
+  ESP_RETURN_ON_FALSE(prefix.address.family != NetworkAddressFamily::unknown, ESP_ERR_INVALID_ARG, TAG, "prefix address family is unknown");
+  auto configuration = CopyConfiguration();
+  ESP_RETURN_ON_FALSE(configuration, ESP_ERR_INVALID_STATE, TAG, "configuration is read by the current task");
+  configuration->clientAccessRules.push_back({prefix, true});
+  StoreConfiguration();
+  return ESP_OK;
+}
+
+//==============================================================================
+
+esp_err_t TcpServer::DenyClients(const NetworkAddressPrefix& prefix) {
+  LockGuard lg(*this);
+  ESP_RETURN_ON_FALSE(prefix.address.family != NetworkAddressFamily::unknown, ESP_ERR_INVALID_ARG, TAG, "prefix address family is unknown");
+  auto configuration = CopyConfiguration();
+  ESP_RETURN_ON_FALSE(configuration, ESP_ERR_INVALID_STATE, TAG, "configuration is read by the current task");
+  configuration->clientAccessRules.push_back({prefix, false});
+  StoreConfiguration();
+  return ESP_OK;
+}
+
+//==============================================================================
+
+esp_err_t TcpServer::AllowClientsByDefault() {
+  LockGuard lg(*this);
+  auto configuration = CopyConfiguration();
+  ESP_RETURN_ON_FALSE(configuration, ESP_ERR_INVALID_STATE, TAG, "configuration is read by the current task");
+  configuration->clientsAllowedByDefault = true;
+  StoreConfiguration();
+  return ESP_OK;
+}
+
+//==============================================================================
+
+esp_err_t TcpServer::DenyClientsByDefault() {
+  LockGuard lg(*this);
+  auto configuration = CopyConfiguration();
+  ESP_RETURN_ON_FALSE(configuration, ESP_ERR_INVALID_STATE, TAG, "configuration is read by the current task");
+  configuration->clientsAllowedByDefault = false;
+  StoreConfiguration();
+  return ESP_OK;
+}
+
+//==============================================================================
+
+esp_err_t TcpServer::ClearClientAccessRules() {
+  LockGuard lg(*this);
+  auto configuration = CopyConfiguration();
+  ESP_RETURN_ON_FALSE(configuration, ESP_ERR_INVALID_STATE, TAG, "configuration is read by the current task");
+  configuration->clientAccessRules.clear();
+  StoreConfiguration();
+  return ESP_OK;
+}
+
+//==============================================================================
+
+bool TcpServer::IsClientAllowed(const NetworkAddress& address) {
+  auto configuration = GetConfiguration();
+  for (auto& rule : configuration->clientAccessRules) {
+    if (rule.prefix.Contains(address))
+      return rule.allow;
+  }
+  return configuration->clientsAllowedByDefault;
+}
+
+//==============================================================================
+
+esp_err_t TcpServer::SetConnectionRateLimit(uint32_t connectionsPerSecond, uint32_t burst) {
+  LockGuard lg(*this);
+  ESP_RETURN_ON_FALSE(!connectionsPerSecond || burst, ESP_ERR_INVALID_ARG, TAG, "burst is zero");
+  connectionRateLimiter = TokenBucket(connectionsPerSecond, burst);
+  return ESP_OK;
+}
+
+//==============================================================================
+
+esp_err_t TcpServer::SetClientConnectionRateLimit(uint32_t connectionsPerSecond, uint32_t burst, size_t numberOfAddresses) {
+  LockGuard lg(*this);
+  ESP_RETURN_ON_FALSE(!connectionsPerSecond || (burst && numberOfAddresses), ESP_ERR_INVALID_ARG, TAG, "burst or number of addresses is zero");
+  clientConnectionRateLimiterPrototype = TokenBucket(connectionsPerSecond, burst);
+  clientConnectionOverflowRateLimiter = clientConnectionRateLimiterPrototype;
+  clientConnectionRateLimiters.clear();
+  if (connectionsPerSecond) {
+    clientConnectionRateLimiters.reserve(numberOfAddresses);
+    clientConnectionRateLimiters.resize(numberOfAddresses, {NetworkAddress(), clientConnectionRateLimiterPrototype, 0});
   }
-  ESP_RETURN_ON_ERROR(error, TAG, "stream socket options set failed");
+  else
+    clientConnectionRateLimiters.shrink_to_fit();
+  return ESP_OK;
+}
+
+//==============================================================================
+
+size_t TcpServer::GetNumberOfRateLimitedConnections() {
+  return numberOfRateLimitedConnections.load(std::memory_order_relaxed);
+}
+
+//==============================================================================
+
+TcpServerStatistics TcpServer::GetStatistics() {
+  TcpServerStatistics statistics;
+  statistics.numberOfAcceptedConnections = numberOfAcceptedConnections.load(std::memory_order_relaxed);
+  statistics.numberOfDeniedConnections = numberOfDeniedConnections.load(std::memory_order_relaxed);
+  statistics.numberOfRateLimitedConnections = numberOfRateLimitedConnections.load(std::memory_order_relaxed);
+  statistics.numberOfMemoryLimitedConnections = numberOfMemoryLimitedConnections.load(std::memory_order_relaxed);
+  for (int i = 0; i < sizeof(statistics.numberOfDisconnections) / sizeof(statistics.numberOfDisconnections[0]); i++)
+    statistics.numberOfDisconnections[i] = numberOfDisconnections[i].load(std::memory_order_relaxed);
+  statistics.numberOfHandledRequests = numberOfHandledRequests.load(std::memory_order_relaxed);
+  for (int i = 0; i < TcpServerStatistics::handleRequestDurationHistogramSize; i++)
+    statistics.handleRequestDurationHistogram[i] = handleRequestDurationHistogram[i].load(std::memory_order_relaxed);
+  return statistics;
+}
+
+//==============================================================================
+
+esp_err_t TcpServer::SetReadRateLimit(uint32_t bytesPerSecond, uint32_t burst) {
+  LockGuard lg(*this);
+  ESP_RETURN_ON_ERROR(readTokenBucket->SetRate(bytesPerSecond, burst), TAG, "read token bucket rate set failed");
+  for (auto& clientStream : clientStreams)
+    clientStream->SetSharedReadTokenBucket(bytesPerSecond ? readTokenBucket : nullptr);
+  return ESP_OK;
+}
+
+//==============================================================================
+
+esp_err_t TcpServer::SetWriteRateLimit(uint32_t bytesPerSecond, uint32_t burst) {
+  LockGuard lg(*this);
+  ESP_RETURN_ON_ERROR(writeTokenBucket->SetRate(bytesPerSecond, burst), TAG, "write token bucket rate set failed");
+  for (auto& clientStream : clientStreams)
+    clientStream->SetSharedWriteTokenBucket(bytesPerSecond ? writeTokenBucket : nullptr);
+  return ESP_OK;
+}
+
+//==============================================================================
+
+esp_err_t TcpServer::SetHandleRequestBudget(size_t numberOfBytes, uint32_t time) {
+  LockGuard lg(*this);
+  auto configuration = CopyConfiguration();
+  ESP_RETURN_ON_FALSE(configuration, ESP_ERR_INVALID_STATE, TAG, "configuration is read by the current task");
+  configuration->handleRequestByteBudget = numberOfBytes;
+  configuration->handleRequestTimeBudget = time;
+  StoreConfiguration();
+  return ESP_OK;
+}
+
+//==============================================================================
+
+esp_err_t TcpServer::SetMemoryBudget(size_t connectionMemorySize, size_t maxMemorySize, size_t freeHeapWatermark) {
+  LockGuard lg(*this);
+  auto configuration = CopyConfiguration();
+  ESP_RETURN_ON_FALSE(configuration, ESP_ERR_INVALID_STATE, TAG, "configuration is read by the current task");
+  configuration->connectionMemorySize = connectionMemorySize;
+  configuration->maxConnectionMemorySize = maxMemorySize;
+  configuration->freeHeapWatermark = freeHeapWatermark;
+  StoreConfiguration();
+  return ESP_OK;
+}
+
+//==============================================================================
+
+esp_err_t TcpServer::SetLowMemoryReceiveBufferSize(size_t freeHeapSize, int receiveBufferSize) {
+  LockGuard lg(*this);
+  ESP_RETURN_ON_FALSE(!freeHeapSize || receiveBufferSize > 0, ESP_ERR_INVALID_ARG, TAG, "invalid receive buffer size");
+#if !CONFIG_IDF_TARGET_LINUX && !CONFIG_LWIP_SO_RCVBUF
+  ESP_RETURN_ON_FALSE(!freeHeapSize, ESP_ERR_NOT_SUPPORTED, TAG, "receive buffer size requires CONFIG_LWIP_SO_RCVBUF");
+#endif
+  auto configuration = CopyConfiguration();
+  ESP_RETURN_ON_FALSE(configuration, ESP_ERR_INVALID_STATE, TAG, "configuration is read by the current task");
+  configuration->lowMemoryFreeHeapSize = freeHeapSize;
+  configuration->lowMemoryReceiveBufferSize = receiveBufferSize;
+  StoreConfiguration();
+  return ESP_OK;
+}
+
+//==============================================================================
+
+std::shared_ptr<NetworkBufferAllocator> TcpServer::GetBufferAllocator() {
+  LockGuard lg(*this);
+  return bufferAllocator ? bufferAllocator : NetworkBufferAllocator::GetDefault();
+}
+
+//==============================================================================
+
+esp_err_t TcpServer::SetBufferAllocator(std::shared_ptr<NetworkBufferAllocator> allocator) {
+  LockGuard lg(*this);
+  // The pending client events are moved to the new allocator. The event queue of a running dispatcher task is moved when it is restarted.
+  ESP_RETURN_ON_ERROR(AllocatePendingClientEvents(allocator ? allocator : NetworkBufferAllocator::GetDefault(), pendingClientEvents.GetSize()),
+                      TAG, "pending client events allocate failed");
+  bufferAllocator = allocator;
+  for (auto& clientStream : clientStreams)
+    clientStream->SetBufferAllocator(allocator);
+  return ESP_OK;
+}
+
+//==============================================================================
+
+SocketProfile TcpServer::GetSocketProfile() {
+  return GetConfiguration()->socketProfile;
+}
+
+//==============================================================================
+
+esp_err_t TcpServer::SetSocketProfile(const SocketProfile& profile) {
+  LockGuard lg(*this);
+  ESP_RETURN_ON_ERROR(SocketProfile::Validate(profile), TAG, "invalid socket profile");
+  auto configuration = CopyConfiguration();
+  ESP_RETURN_ON_FALSE(configuration, ESP_ERR_INVALID_STATE, TAG, "configuration is read by the current task");
+  configuration->socketProfile = profile;
+  StoreConfiguration();
+  ESP_RETURN_ON_ERROR(ApplySocketProfile(), TAG, "socket profile apply failed");
+  return ESP_OK;
+}
+
+//==============================================================================
+
+TcpServerEventDispatchMode TcpServer::GetEventDispatchMode() {
+  LockGuard lg(*this);
+  return eventDispatchMode;
+}
+
+//==============================================================================
+
+esp_err_t TcpServer::SetEventDispatchMode(TcpServerEventDispatchMode mode, size_t queueSize, const TaskParameters& taskParameters) {
+  LockGuard lg(*this);
+  ESP_RETURN_ON_FALSE(!IsEnabled(), ESP_ERR_INVALID_STATE, TAG, "server is enabled");
+  ESP_RETURN_ON_FALSE(mode != TcpServerEventDispatchMode::dispatcherTask || queueSize, ESP_ERR_INVALID_ARG, TAG, "queue size is zero");
+  // The dispatcher task can be waiting for the server lock in an event handler
+  ESP_RETURN_ON_ERROR(StopEventDispatcher(disableTimeout), TAG, "event dispatcher stop failed");
+  eventDispatchMode = TcpServerEventDispatchMode::immediate;
+  if (mode == TcpServerEventDispatchMode::dispatcherTask)
+    ESP_RETURN_ON_ERROR(StartEventDispatcher(queueSize, taskParameters), TAG, "event dispatcher start failed");
+  eventDispatchMode = mode;
+  return ESP_OK;
+}
+
+//==============================================================================
+
+TcpServer::Snapshot<TcpServer::Configuration>::Reader TcpServer::GetConfiguration() {
+  return Snapshot<Configuration>::Reader(configuration);
+}
+
+//==============================================================================
+
+TcpServer::Configuration* TcpServer::CopyConfiguration() {
+  // The inactive configuration buffer is updated in place (the access rules vector keeps its capacity)
+  Configuration* newConfiguration = configuration.GetInactive();
+  if (newConfiguration)
+    *newConfiguration = *GetConfiguration();
+  return newConfiguration;
+}
+
+//==============================================================================
+
+void TcpServer::StoreConfiguration() {
+  configuration.Swap();
+}
+
+//==============================================================================
+
+void TcpServer::PublishClientStreams() {
+  // Both buffers keep the capacity of the client stream list, so that no heap is used when the clients connect and disconnect.
+  // The previous list is cleared, so that the disconnected pool streams are not referenced by it.
+  // The published client streams are only read by GetClientStreams that does not keep the reader.
+  auto newClientStreams = publishedClientStreams.GetInactive();
+  newClientStreams->reserve(clientStreams.capacity());
+  *newClientStreams = clientStreams;
+  publishedClientStreams.Swap();
+  auto previousClientStreams = publishedClientStreams.GetInactive();
+  previousClientStreams->clear();
+  previousClientStreams->reserve(clientStreams.capacity());
+}
+
+//==============================================================================
+
+esp_err_t TcpServer::ApplySocketProfile() {
+  SocketProfile socketProfile = GetConfiguration()->socketProfile;
+  esp_err_t error = ESP_OK;
+  for (auto& clientStream : clientStreams)
+    error = clientStream->SetSocketProfile(socketProfile) == ESP_OK ? error : ESP_FAIL;
+  ESP_RETURN_ON_ERROR(error, TAG, "socket profile apply failed");
   return ESP_OK;
 }
 
 //==============================================================================
 
+bool TcpServer::IsConnectionRateAllowed(const NetworkAddress& address) {
+  if (!connectionRateLimiter.GetAvailableTokens())
+    return false;
+
+  if (clientConnectionRateLimiters.size()) {
+    // Find the address or the least recently used one
+    auto clientRateLimiter = clientConnectionRateLimiters.begin();
+    for (auto it = clientConnectionRateLimiters.begin(); it != clientConnectionRateLimiters.end(); it++) {
+      if (it->address == address) {
+        clientRateLimiter = it;
+        break;
+      }
+      if (it->lastConnectionTime < clientRateLimiter->lastConnectionTime)
+        clientRateLimiter = it;
+    }
+    if (clientRateLimiter->address != address) {
+      // The least recently used address is only replaced when its bucket is full again, so that the replacement does not reset its limit.
+      // Otherwise the address is limited by the bucket shared by all addresses that do not fit, so that cycling through more source
+      // addresses than are tracked does not bypass the limit.
+      TokenBucket& tokenBucket = clientRateLimiter->tokenBucket;
+      if (clientRateLimiter->lastConnectionTime && tokenBucket.GetAvailableTokens() < tokenBucket.GetCapacity())
+        return clientConnectionOverflowRateLimiter.TryTake() && connectionRateLimiter.TryTake();
+      clientRateLimiter->address = address;
+      tokenBucket = clientConnectionRateLimiterPrototype;
+    }
+    clientRateLimiter->lastConnectionTime = GetTimeInMicroseconds();
+    if (!clientRateLimiter->tokenBucket.TryTake())
+      return false;
+  }
+
+  return connectionRateLimiter.TryTake();
+}
+
+//==============================================================================
+
+bool TcpServer::IsConnectionMemoryAvailable() {
+  auto configuration = GetConfiguration();
+  if (configuration->maxConnectionMemorySize && (clientStreams.size() + 1) * configuration->connectionMemorySize > configuration->maxConnectionMemorySize)
+    return false;
+  return !configuration->freeHeapWatermark || GetFreeHeapSize() >= configuration->freeHeapWatermark + configuration->connectionMemorySize;
+}
+
+//==============================================================================
+
 void TcpServer::TaskCode(void* parameters) {
   TcpServer& server = *(TcpServer*)parameters;
-  int sock = -1;
-
-  while (!server.disable) {
-    if (server.Lock(0) == ESP_OK) {
-      if (sock >= 0 || (sock = server.Listen()) >= 0) {
-        // Remove disconnected clients
-        for (auto clientStream = server.clientStreams.begin(); clientStream != server.clientStreams.end();) {
-          if ((*clientStream)->IsOpen())
-            clientStream++;
-          else {
-            server.clientDisconnectedEvent.Generate(**clientStream);
-            server.clientStreams.erase(clientStream);
-          }
-        }
+  while (true) {
+    while (server.Process()) {
+      // The task sleeps until a socket event, a wake-up or the next deadline of the server
+      fd_set set;
+      FD_ZERO(&set);
+      int maxSock = -1;
+      TickType_t timeout = server.PrepareWait(set, maxSock);
+      WaitForEvents(set, maxSock, server.wakeSock, server.taskWakeSemaphore, timeout);
+    }
+    // Statically allocated task is parked while the server is disabled, so that its memory is not reused before the deferred task deletion
+    bool parked = server.staticTaskHandle == xTaskGetCurrentTaskHandle();
+    // The server can be destroyed right after the stop is signaled, so only the parked task (deleted by the server destructor) can access it
+    xSemaphoreGive(server.taskStoppedSemaphore);
+    if (!parked)
+      break;
+    while (server.disable)
+      ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+  }
+  vTaskDelete(NULL);
+}
+
+//==============================================================================
+
+bool TcpServer::Process() {
+  // The listening socket and the client streams are kept, so that the task can be replaced without dropping the connections.
+  // The task handle is cleared by StopTask under the server lock.
+  if (disable)
+    return false;
+
+  if (Lock(0) != ESP_OK)
+    return true;
+
+  // The server can be disabled after the unlocked check (e.g. between the manual polling check in Poll and this call)
+  if (disable) {
+    Unlock();
+    return false;
+  }
+  processAgain = false;
+
+  if (listenSock < 0 && !draining && (listenSock = Listen()) < 0) {
+    taskHandle = NULL;
+    enabled = false;
+    disable = true;
+    Unlock();
+    return false;
+  }
 
-        // Accept new clients
-        fd_set set;
-        timeval timeout = {};
-        for (bool noPendingConnections = false; server.clientStreams.size() < server.maxNumberOfClients && !noPendingConnections;) {
-          FD_ZERO(&set);
-          FD_SET(sock, &set);
-          if (select(sock + 1, &set, NULL, NULL, &timeout) > 0) {
-            int newClientSock = accept(sock, NULL, NULL);
-            if (newClientSock >= 0) {
-              auto clientStream = std::make_shared<NetworkStream>(newClientSock);
-              server.clientStreams.push_back(clientStream);
-              server.SetStreamSocketOptions();
-              server.clientConnectedEvent.Generate(*clientStream);
+  // Remove disconnected clients
+  bool clientStreamsChanged = false;
+  for (auto clientStream = clientStreams.begin(); clientStream != clientStreams.end();) {
+    if ((*clientStream)->IsOpen())
+      clientStream++;
+    else {
+      numberOfDisconnections[(int)(*clientStream)->GetStatistics().closeReason].fetch_add(1, std::memory_order_relaxed);
+      AddClientEvent(*clientStream, false);
+      clientStream = clientStreams.erase(clientStream);
+      clientStreamsChanged = true;
+    }
+  }
+  if (drainRequested) {
+    drainRequested = false;
+    for (auto& clientStream : clientStreams) {
+      LockGuard lg(*clientStream);
+      if (clientStream->IsOpen())
+        HandleDrain(*clientStream);
+    }
+  }
+  if (draining && clientStreams.empty())
+    xSemaphoreGive(drainedSemaphore);
+
+  // Accept new clients. The configuration is not read for the whole iteration, because the event and request handlers can change it.
+  // A client is only accepted if the pending client events have room for its connection event and the disconnection events of all clients.
+  fd_set set;
+  timeval timeout = {};
+  for (bool noPendingConnections = listenSock < 0; clientStreams.size() < GetConfiguration()->maxNumberOfClients &&
+                                                   numberOfPendingClientEvents + clientStreams.size() < pendingClientEvents.GetSize() && !noPendingConnections;) {
+    FD_ZERO(&set);
+    FD_SET(listenSock, &set);
+    if (select(listenSock + 1, &set, NULL, NULL, &timeout) > 0) {
+      sockaddr_storage clientSockAddr;
+      socklen_t clientSockAddrSize = sizeof(clientSockAddr);
+      int newClientSock = accept(listenSock, (sockaddr*)&clientSockAddr, &clientSockAddrSize);
+      // Rejected clients are closed before any stream allocation or event
+      if (newClientSock >= 0) {
+        PL_NETWORK_TRACE(accept, this, newClientSock);
+        numberOfAcceptedConnections.fetch_add(1, std::memory_order_relaxed);
+        NetworkAddress clientAddress = NetworkStream::SockAddrToEndpoint(clientSockAddr).address;
+        bool rejected = false;
+        if (!IsClientAllowed(clientAddress)) {
+          numberOfDeniedConnections.fetch_add(1, std::memory_order_relaxed);
+          rejected = true;
+        }
+        else if (!IsConnectionRateAllowed(clientAddress)) {
+          numberOfRateLimitedConnections.fetch_add(1, std::memory_order_relaxed);
+          rejected = true;
+        }
+        else if (!IsConnectionMemoryAvailable()) {
+          numberOfMemoryLimitedConnections.fetch_add(1, std::memory_order_relaxed);
+          rejected = true;
+        }
+        if (rejected) {
+          CloseRejectedSocket(newClientSock);
+          newClientSock = -1;
+        }
+      }
+      if (newClientSock >= 0) {
+        auto clientStream = clientStreamPool.Open(newClientSock);
+        // Pool streams that are still referenced outside the server are not reused
+        if (!clientStream && !numberOfStaticClientStreams)
+          clientStream = std::make_shared<NetworkStream>(newClientSock);
+        if (clientStream) {
+          // Shared token buckets are only attached when limited to avoid locking them on every transfer
+          if (readTokenBucket->IsLimited())
+            clientStream->SetSharedReadTokenBucket(readTokenBucket);
+          if (writeTokenBucket->IsLimited())
+            clientStream->SetSharedWriteTokenBucket(writeTokenBucket);
+          clientStream->SetBufferAllocator(bufferAllocator);
+          clientStreams.push_back(clientStream);
+          clientStreamsChanged = true;
+          // Only the new client stream is configured, so that the accept cost does not grow with the number of clients.
+          // The configuration reader is released before the event handlers that can change the configuration are called.
+          {
+            auto configuration = GetConfiguration();
+            if (configuration->lowMemoryFreeHeapSize && GetFreeHeapSize() < configuration->lowMemoryFreeHeapSize) {
+              // Smaller receive window limits the pbufs queued by lwIP for the connection
+              SocketProfile socketProfile = configuration->socketProfile;
+              socketProfile.receiveBufferSize = configuration->lowMemoryReceiveBufferSize;
+              if (clientStream->SetSocketProfile(socketProfile) != ESP_OK)
+                ESP_LOGW(TAG, "low memory socket profile set failed");
             }
+            else if (clientStream->SetSocketProfile(configuration->socketProfile) != ESP_OK)
+              ESP_LOGW(TAG, "socket profile set failed");
           }
-          else
-            noPendingConnections = true;
+          AddClientEvent(clientStream, true);
         }
+        else
+          CloseRejectedSocket(newClientSock);
+      }
+    }
+    else
+      noPendingConnections = true;
+  }
 
-        // Handle requests
-        for (auto& clientStream : server.clientStreams) {
-          LockGuard lg(*clientStream);
-          if (clientStream->GetReadableSize())
-            server.HandleRequest(*clientStream);
-        }
+  if (clientStreamsChanged)
+    PublishClientStreams();
+
+  // Handle requests. The server stays locked (server methods called by the request handlers lock it recursively), so that the server lock
+  // is always taken before the client stream lock. The getters do not lock the server and are not delayed by the request handlers.
+  // The first handled client is rotated, so that the clients handled last in one iteration are handled first in the next one.
+  size_t handleRequestByteBudget;
+  uint32_t handleRequestTimeBudget;
+  {
+    auto configuration = GetConfiguration();
+    handleRequestByteBudget = configuration->handleRequestByteBudget;
+    handleRequestTimeBudget = configuration->handleRequestTimeBudget;
+  }
+  size_t numberOfHandledClients = clientStreams.size();
+  size_t firstIndex = numberOfHandledClients ? firstHandledClientIndex++ % numberOfHandledClients : 0;
+  for (size_t i = 0; i < numberOfHandledClients; i++) {
+    // The stream reference is kept, because the request handler can reallocate the client stream list (e.g. SetMaxNumberOfClients)
+    std::shared_ptr<NetworkStream> clientStream = clientStreams[(firstIndex + i) % numberOfHandledClients];
+    LockGuard lg(*clientStream);
+    if (size_t readableSize = clientStream->GetReadableSize()) {
+      // The handler can leave the data unread, so the server is processed again without waiting for the socket events
+      processAgain = true;
+      PL_NETWORK_TRACE(readable, clientStream.get(), readableSize);
+      PL_NETWORK_TRACE(handleRequestBegin, clientStream.get(), 0);
+      int64_t startTime = GetTimeInMicroseconds();
+      if (handleRequestByteBudget)
+        clientStream->readBudget = handleRequestByteBudget * clientStream->weight;
+      if (handleRequestTimeBudget)
+        clientStream->readBudgetDeadline = startTime + (int64_t)handleRequestTimeBudget * clientStream->weight;
+      esp_err_t error = HandleRequest(*clientStream);
+      clientStream->readBudget = SIZE_MAX;
+      clientStream->readBudgetDeadline = 0;
+      AddHandleRequestDuration(GetTimeInMicroseconds() - startTime);
+      PL_NETWORK_TRACE(handleRequestEnd, clientStream.get(), error);
+    }
+  }
 
-        if (server.disableFromRequest) {
-          server.disableFromRequest = false;
-          for (auto& clientStream : server.clientStreams)
-            clientStream->Close();
-          server.clientStreams.clear();
-          close(sock);
-          sock = -1;
-          if (!server.enableFromRequest) {
-            server.disabledEvent.Generate();
-            server.taskHandle = NULL;
-            server.Unlock();
-            vTaskDelete(NULL);
-            return;
-          }
-        }
-        server.enableFromRequest = false;
+  // Enable and disable calls from the request handlers are processed after the requests are handled
+  bool taskRunning = true;
+  if (disableFromRequest) {
+    disableFromRequest = false;
+    for (auto& clientStream : clientStreams)
+      clientStream->Close();
+    clientStreams.clear();
+    PublishClientStreams();
+    if (listenSock >= 0) {
+      close(listenSock);
+      listenSock = -1;
+    }
+    draining = false;
+    drainRequested = false;
+    if (!enableFromRequest) {
+      disabledEvent.Generate();
+      taskHandle = NULL;
+      disable = true;
+      manuallyEnabled = false;
+      enabled = false;
+      taskRunning = false;
+    }
+  }
+  enableFromRequest = false;
+
+  // Deferred client events are dispatched after the requests are handled, so that the event handlers do not delay them
+  bool generatePendingClientEvents = false;
+  if (numberOfPendingClientEvents) {
+    if (eventDispatchMode == TcpServerEventDispatchMode::dispatcherTask)
+      QueuePendingClientEvents();
+    else if (!taskRunning) {
+      // The server can be deleted as soon as it is unlocked after the task is stopped
+      ClientEvent clientEvent;
+      while (TakePendingClientEvent(clientEvent))
+        GenerateClientEvent(clientEvent);
+    }
+    else
+      generatePendingClientEvents = true;
+  }
+  Unlock();
+
+  if (generatePendingClientEvents)
+    GeneratePendingClientEvents();
+  return taskRunning;
+}
+
+//==============================================================================
+
+TickType_t TcpServer::PrepareWait(fd_set& set, int& maxSock) {
+  // The server that is locked by another task is checked again in the next tick
+  if (Lock(0) != ESP_OK)
+    return 1;
+  TickType_t timeout = maxIdleWaitTime;
+  if (disable || processAgain || drainRequested || (listenSock < 0 && !draining))
+    timeout = 0;
+  // The events that do not fit into the dispatcher queue are queued again in the next tick
+  else if (numberOfPendingClientEvents)
+    timeout = 1;
+  else {
+    if (listenSock >= 0 && clientStreams.size() < GetConfiguration()->maxNumberOfClients) {
+      FD_SET(listenSock, &set);
+      maxSock = std::max(maxSock, listenSock);
+    }
+    for (auto& clientStream : clientStreams) {
+      if (clientStream->Lock(0) != ESP_OK) {
+        timeout = 1;
+        continue;
       }
+      // The data of the stream with the exhausted shared rate limit is not readable until the tokens are refilled
+      if (int64_t refillTime = clientStream->GetSharedTokenRefillTime())
+        timeout = std::min<TickType_t>(timeout, std::max<int64_t>((refillTime + 999) / 1000 / portTICK_PERIOD_MS, 1));
+      else if (clientStream->sock >= 0) {
+        FD_SET(clientStream->sock, &set);
+        maxSock = std::max(maxSock, clientStream->sock);
+      }
+      // The closed stream is removed without waiting
       else
-        server.disable = true;
-
-      server.Unlock();
+        timeout = 0;
+      clientStream->Unlock();
     }
-    vTaskDelay(1);
   }
+  Unlock();
+  return timeout;
+}
+
+//==============================================================================
 
+void TcpServer::WakeTask() {
+  if (host) {
+    host->Wake();
+    return;
+  }
+  xSemaphoreGive(taskWakeSemaphore);
+  int sock = wakeSock;
   if (sock >= 0)
-    close(sock);
-  
-  server.taskHandle = NULL;
+    SendWake(sock);
+}
+
+//==============================================================================
+
+void TcpServer::WaitForEvents(fd_set& set, int maxSock, int wakeSock, SemaphoreHandle_t wakeSemaphore, TickType_t timeout) {
+  if (!timeout)
+    return;
+  // The sockets are polled every tick if the wake socket is not available
+  if (wakeSock < 0) {
+    xSemaphoreTake(wakeSemaphore, 1);
+    return;
+  }
+  FD_SET(wakeSock, &set);
+  uint64_t timeoutMs = (uint64_t)timeout * portTICK_PERIOD_MS;
+  timeval selectTimeout = {};
+  selectTimeout.tv_sec = timeoutMs / 1000;
+  selectTimeout.tv_usec = timeoutMs % 1000 * 1000;
+  select(std::max(maxSock, wakeSock) + 1, &set, NULL, NULL, &selectTimeout);
+  ReceiveWakes(wakeSock);
+  xSemaphoreTake(wakeSemaphore, 0);
+}
+
+//==============================================================================
+
+void TcpServer::DeleteStaticTask() {
+  if (!staticTaskHandle)
+    return;
+  // The parked task is deleted when it is blocked, so that the deletion is not deferred and the task memory can be reused
+  for (eTaskState state; (state = eTaskGetState(staticTaskHandle)) != eBlocked && state != eSuspended;)
+    vTaskDelay(1);
+  vTaskDelete(staticTaskHandle);
+  staticTaskHandle = NULL;
+}
+
+//==============================================================================
+
+void TcpServer::CloseRejectedSocket(int sock) {
+  // Reset the connection instead of the graceful close to avoid keeping the socket in TIME_WAIT state
+  linger reset = {1, 0};
+  setsockopt(sock, SOL_SOCKET, SO_LINGER, &reset, sizeof(reset));
+  close(sock);
+}
+
+//==============================================================================
+
+void TcpServer::AddHandleRequestDuration(int64_t duration) {
+  numberOfHandledRequests.fetch_add(1, std::memory_order_relaxed);
+  int bin = 0;
+  for (int64_t binLimit = TcpServerStatistics::handleRequestDurationHistogramResolution;
+       duration >= binLimit && bin < TcpServerStatistics::handleRequestDurationHistogramSize - 1; binLimit *= 2, bin++);
+  handleRequestDurationHistogram[bin].fetch_add(1, std::memory_order_relaxed);
+}
+
+//==============================================================================
+
+esp_err_t TcpServer::ReservePendingClientEvents(size_t maxNumberOfClients) {
+  // The ring is only enlarged, because the connected clients above a reduced maximum number of clients are kept
+  if (pendingClientEvents.GetSize() >= maxNumberOfClients * 2)
+    return ESP_OK;
+  ESP_RETURN_ON_ERROR(AllocatePendingClientEvents(GetBufferAllocator(), maxNumberOfClients * 2), TAG, "pending client events allocate failed");
+  return ESP_OK;
+}
+
+//==============================================================================
+
+esp_err_t TcpServer::AllocatePendingClientEvents(std::shared_ptr<NetworkBufferAllocator> allocator, size_t size) {
+  NetworkBufferArray<ClientEvent> newPendingClientEvents;
+  ESP_RETURN_ON_ERROR(newPendingClientEvents.Allocate(allocator, size), TAG, "out of memory");
+  for (size_t i = 0; i < numberOfPendingClientEvents; i++)
+    newPendingClientEvents[i] = std::move(pendingClientEvents[(pendingClientEventsHead + i) % pendingClientEvents.GetSize()]);
+  pendingClientEvents.Swap(newPendingClientEvents);
+  pendingClientEventsHead = 0;
+  return ESP_OK;
+}
+
+//==============================================================================
+
+void TcpServer::AddClientEvent(const std::shared_ptr<NetworkStream>& clientStream, bool connected) {
+  ClientEvent clientEvent = {clientStream, connected};
+  // The pending client events always have room for the event, because the clients are only accepted if they fit (see Process)
+  if (eventDispatchMode == TcpServerEventDispatchMode::immediate || numberOfPendingClientEvents == pendingClientEvents.GetSize())
+    GenerateClientEvent(clientEvent);
+  else
+    pendingClientEvents[(pendingClientEventsHead + numberOfPendingClientEvents++) % pendingClientEvents.GetSize()] = std::move(clientEvent);
+}
+
+//==============================================================================
+
+bool TcpServer::TakePendingClientEvent(ClientEvent& clientEvent) {
+  if (!numberOfPendingClientEvents)
+    return false;
+  clientEvent = std::move(pendingClientEvents[pendingClientEventsHead]);
+  pendingClientEventsHead = (pendingClientEventsHead + 1) % pendingClientEvents.GetSize();
+  numberOfPendingClientEvents--;
+  return true;
+}
+
+//==============================================================================
+
+void TcpServer::GenerateClientEvent(ClientEvent& clientEvent) {
+  if (clientEvent.connected)
+    clientConnectedEvent.Generate(*clientEvent.stream);
+  else
+    clientDisconnectedEvent.Generate(*clientEvent.stream);
+}
+
+//==============================================================================
+
+void TcpServer::GeneratePendingClientEvents() {
+  // The server is only locked to take the event, so that the event handlers do not delay the server methods
+  ClientEvent clientEvent;
+  while (true) {
+    {
+      LockGuard lg(*this);
+      if (!TakePendingClientEvent(clientEvent))
+        return;
+    }
+    GenerateClientEvent(clientEvent);
+  }
+}
+
+//==============================================================================
+
+void TcpServer::QueuePendingClientEvents() {
+  // Events that do not fit into the queue are kept in order and queued in the next iterations
+  bool queued = false;
+  while (numberOfPendingClientEvents && QueueClientEvent(pendingClientEvents[pendingClientEventsHead])) {
+    pendingClientEventsHead = (pendingClientEventsHead + 1) % pendingClientEvents.GetSize();
+    numberOfPendingClientEvents--;
+    queued = true;
+  }
+  if (queued)
+    xSemaphoreGive(eventDispatcherWakeSemaphore);
+}
+
+//==============================================================================
+
+bool TcpServer::QueueClientEvent(ClientEvent& clientEvent) {
+  // Single producer (server task) and single consumer (dispatcher task) ring buffer
+  size_t tail = eventQueueTail.load(std::memory_order_relaxed);
+  if (tail - eventQueueHead.load(std::memory_order_acquire) == eventQueue.GetSize())
+    return false;
+  eventQueue[tail % eventQueue.GetSize()] = std::move(clientEvent);
+  eventQueueTail.store(tail + 1, std::memory_order_release);
+  return true;
+}
+
+//==============================================================================
+
+void TcpServer::DispatchQueuedClientEvents() {
+  size_t head = eventQueueHead.load(std::memory_order_relaxed);
+  while (head != eventQueueTail.load(std::memory_order_acquire)) {
+    ClientEvent clientEvent = std::move(eventQueue[head % eventQueue.GetSize()]);
+    eventQueueHead.store(++head, std::memory_order_release);
+    GenerateClientEvent(clientEvent);
+  }
+}
+
+//==============================================================================
+
+esp_err_t TcpServer::StartEventDispatcher(size_t queueSize, const TaskParameters& taskParameters) {
+  ESP_RETURN_ON_FALSE(xSemaphoreTake(eventDispatcherStoppedSemaphore, disableTimeout) == pdTRUE, ESP_ERR_TIMEOUT, TAG, "previous event dispatcher stop timeout");
+  if (eventQueue.Allocate(GetBufferAllocator(), queueSize) != ESP_OK) {
+    xSemaphoreGive(eventDispatcherStoppedSemaphore);
+    ESP_RETURN_ON_ERROR(ESP_ERR_NO_MEM, TAG, "event queue allocate failed");
+  }
+  eventQueueHead = 0;
+  eventQueueTail = 0;
+  stopEventDispatcher = false;
+  if (xTaskCreatePinnedToCore(EventDispatcherTaskCode, (GetName() + "_events").c_str(), taskParameters.stackDepth, this, taskParameters.priority,
+                              &eventDispatcherTaskHandle, taskParameters.coreId) != pdPASS) {
+    eventDispatcherTaskHandle = NULL;
+    xSemaphoreGive(eventDispatcherStoppedSemaphore);
+    ESP_RETURN_ON_ERROR(ESP_FAIL, TAG, "event dispatcher task create failed");
+  }
+  return ESP_OK;
+}
+
+//==============================================================================
+
+esp_err_t TcpServer::StopEventDispatcher(TickType_t timeout) {
+  if (!eventDispatcherTaskHandle)
+    return ESP_OK;
+  stopEventDispatcher = true;
+  xSemaphoreGive(eventDispatcherWakeSemaphore);
+  ESP_RETURN_ON_FALSE(xSemaphoreTake(eventDispatcherStoppedSemaphore, timeout) == pdTRUE, ESP_ERR_TIMEOUT, TAG, "event dispatcher stop timeout");
+  xSemaphoreGive(eventDispatcherStoppedSemaphore);
+  eventDispatcherTaskHandle = NULL;
+  // The queue is dispatched by the task before it stops, so the events that did not fit into it are generated in order
+  ClientEvent clientEvent;
+  while (TakePendingClientEvent(clientEvent))
+    GenerateClientEvent(clientEvent);
+  eventQueue.Free();
+  return ESP_OK;
+}
+
+//==============================================================================
+
+void TcpServer::EventDispatcherTaskCode(void* parameters) {
+  TcpServer& server = *(TcpServer*)parameters;
+  while (!server.stopEventDispatcher) {
+    xSemaphoreTake(server.eventDispatcherWakeSemaphore, portMAX_DELAY);
+    server.DispatchQueuedClientEvents();
+  }
+  // The server can be destroyed right after the stop is signaled
+  xSemaphoreGive(server.eventDispatcherStoppedSemaphore);
   vTaskDelete(NULL);
 }
 
 //==============================================================================
 
 int TcpServer::Listen() {
+  auto configuration = GetConfiguration();
   int sock;
   if ((sock = socket(AF_INET6, SOCK_STREAM, IPPROTO_TCP)) >= 0) {
     int enableAddressReuse = 1;
     if (setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &enableAddressReuse, sizeof(enableAddressReuse)) == 0) {
       sockaddr_in6 addr = {};
       addr.sin6_family = AF_INET6;
-      addr.sin6_port = htons(port);
+      addr.sin6_port = htons(configuration->port);
+      // Accept IPv4 connections as IPv4-mapped IPv6 addresses (not the default on all platforms)
+      int ipV6Only = 0;
+      setsockopt(sock, IPPROTO_IPV6, IPV6_V6ONLY, &ipV6Only, sizeof(ipV6Only));
       if (bind(sock, (sockaddr*)&addr, sizeof(addr)) == 0) {
-        if (listen(sock, maxNumberOfClients) == 0)
+        if (listen(sock, configuration->maxNumberOfClients) == 0)
           return sock;
         else
           ESP_LOGE(TAG, "socket listen failed (%d)", errno);
@@ -338,14 +1325,87 @@ int TcpServer::Listen() {
 
 //==============================================================================
 
-esp_err_t TcpServer::RestartIfEnabled() {
-  if (!taskHandle || disableFromRequest)
-    return ESP_OK;
-  ESP_RETURN_ON_ERROR(Disable(), TAG, "disable failed");
-  ESP_RETURN_ON_ERROR(Enable(), TAG, "enable failed");
+esp_err_t TcpServer::StartTask() {
+  // The previous task can still be finishing after the disable from the request handler
+  ESP_RETURN_ON_FALSE(xSemaphoreTake(taskStoppedSemaphore, disableTimeout) == pdTRUE, ESP_ERR_TIMEOUT, TAG, "previous task stop timeout");
+  disable = false;
+  numberOfStartedTasks++;
+  // The wake socket of the own task is kept until the server is destroyed, so that WakeTask can use it without the server lock
+  if (!host && wakeSock < 0)
+    wakeSock = OpenWakeSocket();
+  if (host) {
+    if (esp_err_t error = host->AddServer(*this, &taskHandle)) {
+      xSemaphoreGive(taskStoppedSemaphore);
+      ESP_RETURN_ON_ERROR(error, TAG, "host add failed");
+    }
+  }
+  else if (staticTaskStack) {
+    if (staticTaskHandle) {
+      taskHandle = staticTaskHandle;
+      xTaskNotifyGive(staticTaskHandle);
+    }
+    else {
+      taskHandle = staticTaskHandle = xTaskCreateStaticPinnedToCore(TaskCode, GetName().c_str(), staticTaskStackDepth, this, taskParameters.priority,
+                                                                    staticTaskStack, staticTaskBuffer, taskParameters.coreId);
+      if (!taskHandle) {
+        xSemaphoreGive(taskStoppedSemaphore);
+        ESP_RETURN_ON_ERROR(ESP_FAIL, TAG, "task create failed");
+      }
+    }
+  }
+  else if (xTaskCreatePinnedToCore(TaskCode, GetName().c_str(), taskParameters.stackDepth, this, taskParameters.priority, &taskHandle, taskParameters.coreId) != pdPASS) {
+    taskHandle = NULL;
+    xSemaphoreGive(taskStoppedSemaphore);
+    ESP_RETURN_ON_ERROR(ESP_FAIL, TAG, "task create failed");
+  }
   return ESP_OK;
 }
 
 //==============================================================================
 
+esp_err_t TcpServer::StopTask() {
+  TickType_t startTime = xTaskGetTickCount();
+  while (taskHandle) {
+    // The repeated waits share one deadline, so that a task that does not stop (e.g. in a long request handler) is reported
+    TickType_t elapsedTime = xTaskGetTickCount() - startTime;
+    ESP_RETURN_ON_FALSE(elapsedTime < disableTimeout, ESP_ERR_TIMEOUT, TAG, "task stop timeout");
+    uint32_t stoppedTaskNumber = numberOfStartedTasks;
+    disable = true;
+    WakeTask();
+    // The server is unlocked while waiting, so that the request handlers that call the server methods can return.
+    // The wait is repeated in case the task is restarted by another task in the meantime.
+    Unlock();
+    bool stopped = xSemaphoreTake(taskStoppedSemaphore, disableTimeout - elapsedTime) == pdTRUE;
+    if (stopped)
+      xSemaphoreGive(taskStoppedSemaphore);
+    ESP_RETURN_ON_ERROR(Lock(), TAG, "lock failed");
+    if (stopped && numberOfStartedTasks == stoppedTaskNumber)
+      taskHandle = NULL;
+  }
+  return ESP_OK;
+}
+
+//==============================================================================
+
+void TcpServer::Stop() {
+  disable = true;
+  manuallyEnabled = false;
+  draining = false;
+  drainRequested = false;
+  if (listenSock >= 0) {
+    close(listenSock);
+    listenSock = -1;
+  }
+
+  for (auto& clientStream : clientStreams)
+    clientStream->Close();
+  clientStreams.clear();
+  PublishClientStreams();
+
+  enabled = false;
+  disabledEvent.Generate();
+}
+
+//==============================================================================
+
 }
\ No newline at end of file
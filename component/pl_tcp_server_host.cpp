@@ -0,0 +1,179 @@
+#include "pl_tcp_server_host.h"
+#include "pl_network_platform.h"
+#include "esp_check.h"
+#include <algorithm>
+
+//==============================================================================
+
+static const char* TAG = "pl_tcp_server_host";
+
+//==============================================================================
+
+namespace PL {
+
+//==============================================================================
+
+const TaskParameters TcpServerHost::defaultTaskParameters = {4096, tskIDLE_PRIORITY + 5, 0};
+const std::string TcpServerHost::defaultTaskName = "tcp_server_host";
+
+//==============================================================================
+
+TcpServerHost::TcpServerHost() {
+  taskStoppedSemaphore = xSemaphoreCreateBinaryStatic(&taskStoppedSemaphoreBuffer);
+  xSemaphoreGive(taskStoppedSemaphore);
+  taskWakeSemaphore = xSemaphoreCreateBinaryStatic(&taskWakeSemaphoreBuffer);
+}
+
+//==============================================================================
+
+TcpServerHost::~TcpServerHost() {
+  Lock();
+  std::vector<TcpServer*> attachedServers = this->attachedServers;
+  Unlock();
+  // The servers are disabled as by TcpServer::Disable (the host is unlocked, so that the host task can stop them) and detached from the host
+  for (auto server : attachedServers) {
+    LockGuard lg(*server);
+    // The server cannot be detached before its processing by the host task is stopped
+    while (server->StopTask() == ESP_ERR_TIMEOUT);
+    if (server->IsEnabled())
+      server->Stop();
+    server->host = NULL;
+  }
+  xSemaphoreTake(taskStoppedSemaphore, portMAX_DELAY);
+  if (wakeSock >= 0)
+    close(wakeSock);
+  vSemaphoreDelete(taskWakeSemaphore);
+  vSemaphoreDelete(taskStoppedSemaphore);
+}
+
+//==============================================================================
+
+esp_err_t TcpServerHost::Lock(TickType_t timeout) {
+  esp_err_t error = mutex.Lock(timeout);
+  if (error == ESP_OK)
+    return ESP_OK;
+  if (error == ESP_ERR_TIMEOUT && timeout == 0)
+    return ESP_ERR_TIMEOUT;
+  ESP_RETURN_ON_ERROR(error, TAG, "mutex lock failed");
+  return ESP_OK;
+}
+
+//==============================================================================
+
+esp_err_t TcpServerHost::Unlock() {
+  ESP_RETURN_ON_ERROR(mutex.Unlock(), TAG, "mutex unlock failed");
+  return ESP_OK;
+}
+
+//==============================================================================
+
+TaskParameters TcpServerHost::GetTaskParameters() {
+  LockGuard lg(*this);
+  return taskParameters;
+}
+
+//==============================================================================
+
+esp_err_t TcpServerHost::SetTaskParameters(const TaskParameters& taskParameters) {
+  LockGuard lg(*this);
+  this->taskParameters = taskParameters;
+  return ESP_OK;
+}
+
+//==============================================================================
+
+size_t TcpServerHost::GetNumberOfServers() {
+  LockGuard lg(*this);
+  return servers.size();
+}
+
+//==============================================================================
+
+esp_err_t TcpServerHost::AddServer(TcpServer& server, TaskHandle_t* taskHandle) {
+  LockGuard lg(*this);
+  // The wake socket is kept until the host is destroyed, so that Wake does not send to a closed (and possibly reused) socket
+  if (wakeSock < 0)
+    wakeSock = OpenWakeSocket();
+  if (!this->taskHandle) {
+    // The previous task can still be finishing after its last server was disabled
+    ESP_RETURN_ON_FALSE(xSemaphoreTake(taskStoppedSemaphore, TcpServer::disableTimeout) == pdTRUE, ESP_ERR_TIMEOUT, TAG, "previous task stop timeout");
+    if (xTaskCreatePinnedToCore(TaskCode, defaultTaskName.c_str(), taskParameters.stackDepth, this, taskParameters.priority, &this->taskHandle, taskParameters.coreId) != pdPASS) {
+      this->taskHandle = NULL;
+      xSemaphoreGive(taskStoppedSemaphore);
+      ESP_RETURN_ON_ERROR(ESP_FAIL, TAG, "task create failed");
+    }
+  }
+  if (std::find(servers.begin(), servers.end(), &server) == servers.end())
+    servers.push_back(&server);
+  *taskHandle = this->taskHandle;
+  Wake();
+  return ESP_OK;
+}
+
+//==============================================================================
+
+void TcpServerHost::AttachServer(TcpServer& server) {
+  LockGuard lg(*this);
+  if (std::find(attachedServers.begin(), attachedServers.end(), &server) == attachedServers.end())
+    attachedServers.push_back(&server);
+}
+
+//==============================================================================
+
+void TcpServerHost::DetachServer(TcpServer& server) {
+  LockGuard lg(*this);
+  attachedServers.erase(std::remove(attachedServers.begin(), attachedServers.end(), &server), attachedServers.end());
+}
+
+//==============================================================================
+
+void TcpServerHost::Wake() {
+  xSemaphoreGive(taskWakeSemaphore);
+  int sock = wakeSock;
+  if (sock >= 0)
+    SendWake(sock);
+}
+
+//==============================================================================
+
+void TcpServerHost::TaskCode(void* parameters) {
+  TcpServerHost& host = *(TcpServerHost*)parameters;
+
+  while (true) {
+    // The host is not locked while the servers are processed, so that the request handlers can enable the servers of the host
+    // (the server lock is taken before the host lock by TcpServer::Enable). The copy keeps its capacity, so that no heap is used.
+    host.Lock();
+    host.processedServers = host.servers;
+    host.Unlock();
+    for (auto server : host.processedServers) {
+      if (!server->Process()) {
+        // The server is removed before the stop is signaled, so that it can be added again by the next enable
+        LockGuard lg(host);
+        host.servers.erase(std::remove(host.servers.begin(), host.servers.end(), server), host.servers.end());
+        xSemaphoreGive(server->taskStoppedSemaphore);
+      }
+    }
+
+    // One select call waits for the socket events of all servers (the servers are only try-locked under the host lock)
+    fd_set set;
+    FD_ZERO(&set);
+    int maxSock = -1;
+    TickType_t timeout = TcpServer::maxIdleWaitTime;
+    host.Lock();
+    if (host.servers.empty()) {
+      host.taskHandle = NULL;
+      host.Unlock();
+      xSemaphoreGive(host.taskStoppedSemaphore);
+      vTaskDelete(NULL);
+      return;
+    }
+    for (auto server : host.servers)
+      timeout = std::min(timeout, server->PrepareWait(set, maxSock));
+    host.Unlock();
+    TcpServer::WaitForEvents(set, maxSock, host.wakeSock, host.taskWakeSemaphore, timeout);
+  }
+}
+
+//==============================================================================
+
+}
\ No newline at end of file
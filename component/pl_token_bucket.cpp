@@ -0,0 +1,172 @@
+#include "pl_token_bucket.h"
+#include "pl_network_platform.h"
+#include "esp_check.h"
+#include <algorithm>
+
+//==============================================================================
+
+static const char* TAG = "pl_token_bucket";
+static const int64_t tokenScale = 1000000;
+
+//==============================================================================
+
+namespace PL {
+
+//==============================================================================
+
+TokenBucket::TokenBucket() {}
+
+//==============================================================================
+
+TokenBucket::TokenBucket(uint32_t rate, uint32_t capacity) :
+  rate(rate), capacity(capacity), scaledTokens((int64_t)capacity * tokenScale), lastRefillTime(GetTimeInMicroseconds()) {}
+
+//==============================================================================
+
+bool TokenBucket::TryTake(uint32_t count) {
+  if (!IsLimited())
+    return true;
+  Refill();
+  if (scaledTokens < (int64_t)count * tokenScale)
+    return false;
+  scaledTokens -= (int64_t)count * tokenScale;
+  return true;
+}
+
+//==============================================================================
+
+void TokenBucket::Take(uint32_t count) {
+  if (!IsLimited())
+    return;
+  Refill();
+  scaledTokens -= (int64_t)count * tokenScale;
+}
+
+//==============================================================================
+
+uint32_t TokenBucket::GetAvailableTokens() {
+  if (!IsLimited())
+    return UINT32_MAX;
+  Refill();
+  return std::max<int64_t>(scaledTokens, 0) / tokenScale;
+}
+
+//==============================================================================
+
+int64_t TokenBucket::GetRefillTime(uint32_t count) {
+  if (!IsLimited())
+    return 0;
+  Refill();
+  int64_t missingScaledTokens = (int64_t)count * tokenScale - scaledTokens;
+  return missingScaledTokens > 0 ? (missingScaledTokens + rate - 1) / rate : 0;
+}
+
+//==============================================================================
+
+bool TokenBucket::IsLimited() const {
+  return rate;
+}
+
+//==============================================================================
+
+uint32_t TokenBucket::GetRate() const {
+  return rate;
+}
+
+//==============================================================================
+
+uint32_t TokenBucket::GetCapacity() const {
+  return capacity;
+}
+
+//==============================================================================
+
+void TokenBucket::Refill() {
+  int64_t time = GetTimeInMicroseconds();
+  int64_t maxScaledTokens = (int64_t)capacity * tokenScale;
+  // The elapsed time is limited to the time that fills the bucket, so that the refill does not overflow after a long idle period
+  int64_t elapsedTime = std::min(time - lastRefillTime, (maxScaledTokens - scaledTokens) / rate + 1);
+  scaledTokens = std::min(scaledTokens + elapsedTime * rate, maxScaledTokens);
+  lastRefillTime = time;
+}
+
+//==============================================================================
+
+esp_err_t SharedTokenBucket::Lock(TickType_t timeout) {
+  esp_err_t error = mutex.Lock(timeout);
+  if (error == ESP_OK)
+    return ESP_OK;
+  if (error == ESP_ERR_TIMEOUT && timeout == 0)
+    return ESP_ERR_TIMEOUT;
+  ESP_RETURN_ON_ERROR(error, TAG, "mutex lock failed");
+  return ESP_OK;
+}
+
+//==============================================================================
+
+esp_err_t SharedTokenBucket::Unlock() {
+  ESP_RETURN_ON_ERROR(mutex.Unlock(), TAG, "mutex unlock failed");
+  return ESP_OK;
+}
+
+//==============================================================================
+
+bool SharedTokenBucket::TryTake(uint32_t count) {
+  LockGuard lg(*this);
+  return tokenBucket.TryTake(count);
+}
+
+//==============================================================================
+
+void SharedTokenBucket::Take(uint32_t count) {
+  LockGuard lg(*this);
+  tokenBucket.Take(count);
+}
+
+//==============================================================================
+
+uint32_t SharedTokenBucket::GetAvailableTokens() {
+  LockGuard lg(*this);
+  return tokenBucket.GetAvailableTokens();
+}
+
+//==============================================================================
+
+int64_t SharedTokenBucket::GetRefillTime(uint32_t count) {
+  LockGuard lg(*this);
+  return tokenBucket.GetRefillTime(count);
+}
+
+//==============================================================================
+
+bool SharedTokenBucket::IsLimited() {
+  LockGuard lg(*this);
+  return tokenBucket.IsLimited();
+}
+
+//==============================================================================
+
+uint32_t SharedTokenBucket::GetRate() {
+  LockGuard lg(*this);
+  return tokenBucket.GetRate();
+}
+
+//==============================================================================
+
+uint32_t SharedTokenBucket::GetCapacity() {
+  LockGuard lg(*this);
+  return tokenBucket.GetCapacity();
+}
+
+//==============================================================================
+
+esp_err_t SharedTokenBucket::SetRate(uint32_t rate, uint32_t capacity) {
+  LockGuard lg(*this);
+  ESP_RETURN_ON_FALSE(!rate || capacity, ESP_ERR_INVALID_ARG, TAG, "capacity is zero");
+  tokenBucket = TokenBucket(rate, capacity);
+  return ESP_OK;
+}
+
+//==============================================================================
+
+}
\ No newline at end of file
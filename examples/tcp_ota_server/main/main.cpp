@@ -15,6 +15,7 @@ const int firmwareIsCompatibleWithHardware = true;
 class OtaServer : public PL::TcpServer {
 public:
   static const uint16_t defaultPort = 3232;
+  static const size_t firmwareDataSize = 1024;
 
   OtaServer();
 
@@ -22,9 +23,11 @@ protected:
   esp_err_t HandleRequest(PL::NetworkStream& clientStream) override;
 
 private:
-  char firmwareData[1024];
+  // Firmware data chunks are allocated in PSRAM (if available) to save the internal RAM
+  std::shared_ptr<PL::NetworkBufferAllocator> firmwareDataAllocator =
+    std::make_shared<PL::NetworkBufferAllocator>(MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
 
-  esp_err_t UpdateFirmware(PL::NetworkStream& clientStream, uint32_t* dataSizeToRead, const esp_partition_t* partition, esp_ota_handle_t* handle);
+  esp_err_t UpdateFirmware(PL::NetworkStream& clientStream, char* firmwareData, uint32_t* dataSizeToRead, const esp_partition_t* partition, esp_ota_handle_t* handle);
 };
 
 //==============================================================================
@@ -106,7 +109,9 @@ esp_err_t OtaServer::HandleRequest(PL::NetworkStream& clientStream) {
   ESP_RETURN_ON_ERROR(clientStream.Read(&firmwareSize, sizeof(firmwareSize)), TAG, "firmware size read failed");
   printf("Receiving new firmware (size: %lu)\n", firmwareSize);
 
-  esp_err_t result = UpdateFirmware(clientStream, &firmwareSize, esp_ota_get_next_update_partition(NULL), &updateHandle);
+  char* firmwareData = (char*)firmwareDataAllocator->Allocate(firmwareDataSize);
+  esp_err_t result = firmwareData ? UpdateFirmware(clientStream, firmwareData, &firmwareSize, esp_ota_get_next_update_partition(NULL), &updateHandle) : ESP_ERR_NO_MEM;
+  firmwareDataAllocator->Free(firmwareData, firmwareDataSize);
   if (result != ESP_OK && result != ESP_ERR_TIMEOUT)
     clientStream.Read(NULL, firmwareSize);
   ESP_RETURN_ON_ERROR(result, TAG, "firmware update failed");
@@ -119,14 +124,14 @@ esp_err_t OtaServer::HandleRequest(PL::NetworkStream& clientStream) {
 
 //==============================================================================
 
-esp_err_t OtaServer::UpdateFirmware(PL::NetworkStream& clientStream, uint32_t* dataSizeToRead, const esp_partition_t* partition, esp_ota_handle_t* handle) {
+esp_err_t OtaServer::UpdateFirmware(PL::NetworkStream& clientStream, char* firmwareData, uint32_t* dataSizeToRead, const esp_partition_t* partition, esp_ota_handle_t* handle) {
   ESP_RETURN_ON_ERROR(esp_ota_begin(partition, OTA_WITH_SEQUENTIAL_WRITES, handle), TAG, "OTA begin failed");
   
   uint32_t initialDataSizeToRead = *dataSizeToRead;
   int lastProgress = 0;
 
   while (*dataSizeToRead) {
-    size_t readSize = std::min((size_t)*dataSizeToRead, sizeof(firmwareData));
+    size_t readSize = std::min((size_t)*dataSizeToRead, (size_t)firmwareDataSize);
     ESP_RETURN_ON_ERROR(clientStream.Read(firmwareData, readSize), TAG, "firmware data read failed");
     ESP_RETURN_ON_ERROR(esp_ota_write(*handle, (const void*)firmwareData, readSize), TAG, "OTA write failed");
     *dataSizeToRead -= readSize;
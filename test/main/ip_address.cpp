@@ -23,4 +23,31 @@ void TestIpAddress() {
   TEST_ASSERT(testIpV6AddressFromString == testIpV6Address);
   testIpV6AddressFromString.u8[3] = 0;
   TEST_ASSERT(testIpV6AddressFromString != testIpV6Address);
+
+  PL::IpV6Address testIpV6AddressWithZoneId(testIpV6Address.u32[0], testIpV6Address.u32[1], testIpV6Address.u32[2], testIpV6Address.u32[3], 3);
+  TEST_ASSERT(PL::IpV6Address(testIpV6AddressString + "%3") == testIpV6AddressWithZoneId);
+  TEST_ASSERT(PL::IpV6Address(testIpV6AddressWithZoneId.ToString()) == testIpV6AddressWithZoneId);
+  TEST_ASSERT(PL::IpV6Address("1::2::3%3") == PL::IpV6Address());
+
+  srand(1);
+  for (int i = 0; i < 1000; i++) {
+    PL::IpV4Address ipV4Address((uint32_t)rand() ^ ((uint32_t)rand() << 16));
+    TEST_ASSERT(PL::IpV4Address(ipV4Address.ToString()) == ipV4Address);
+    PL::IpV6Address ipV6Address((uint32_t)rand() ^ ((uint32_t)rand() << 16), (uint32_t)rand() ^ ((uint32_t)rand() << 16),
+      (uint32_t)rand() ^ ((uint32_t)rand() << 16), (uint32_t)rand() ^ ((uint32_t)rand() << 16), rand());
+    TEST_ASSERT(PL::IpV6Address(ipV6Address.ToString()) == ipV6Address);
+    TEST_ASSERT(PL::NetworkAddress(ipV6Address).ToString() == ipV6Address.ToString());
+  }
+
+  PL::NetworkAddressPrefix ipV4Prefix(PL::IpV4Address(1, 2, 0, 0), 15);
+  TEST_ASSERT(ipV4Prefix.Contains(testIpV4Address));
+  TEST_ASSERT(ipV4Prefix.Contains(PL::IpV4Address(1, 3, 255, 255)));
+  TEST_ASSERT(!ipV4Prefix.Contains(PL::IpV4Address(1, 4, 3, 4)));
+  TEST_ASSERT(!ipV4Prefix.Contains(testIpV6Address));
+  TEST_ASSERT(PL::NetworkAddressPrefix(PL::IpV4Address(), 0).Contains(testIpV4Address));
+  
+  PL::NetworkAddressPrefix ipV6Prefix(PL::IpV6Address(0x00, 0x01, 0x02, 0x03, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0), 32);
+  TEST_ASSERT(ipV6Prefix.Contains(testIpV6Address));
+  TEST_ASSERT(!ipV6Prefix.Contains(PL::IpV6Address(0x00, 0x01, 0x02, 0x04, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0)));
+  TEST_ASSERT(!ipV6Prefix.Contains(testIpV4Address));
 }
\ No newline at end of file
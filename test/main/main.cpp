@@ -1,16 +1,20 @@
 #include "unity.h"
-#include "esp_event.h"
-#include "esp_netif.h"
 #include "ip_address.h"
 #include "tcp.h"
+#if !CONFIG_IDF_TARGET_LINUX
+#include "esp_event.h"
+#include "esp_netif.h"
 #include "ethernet.h"
 #include "wifi.h"
+#endif
 
 //==============================================================================
 
 extern "C" void app_main(void) {
+  #if !CONFIG_IDF_TARGET_LINUX
   ESP_ERROR_CHECK(esp_event_loop_create_default());
   ESP_ERROR_CHECK(esp_netif_init());
+  #endif
 
   UNITY_BEGIN();
   RUN_TEST(TestIpAddress);
@@ -18,6 +22,8 @@ extern "C" void app_main(void) {
   #if CONFIG_ETH_USE_ESP32_EMAC
   RUN_TEST(TestEthernet);
   #endif
+  #if !CONFIG_IDF_TARGET_LINUX
   RUN_TEST(TestWiFi);
+  #endif
   UNITY_END();
 }
\ No newline at end of file
@@ -1,10 +1,16 @@
 #include "tcp.h"
 #include "unity.h"
 #include "esp_check.h"
+#include "esp_heap_caps.h"
 
 //==============================================================================
 
+#if CONFIG_IDF_TARGET_LINUX
+// Ports below 1024 require root privileges on Linux
+static uint16_t port = 50500;
+#else
 static uint16_t port = 500;
+#endif
 const size_t maxNumberOfClients = 2;
 const PL::IpV4Address ipV4Address(127, 0, 0, 1);
 const PL::IpV6Address ipV6Address(0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1);
@@ -12,6 +18,8 @@ const TickType_t readTimeout = 1000 / portTICK_PERIOD_MS;
 const uint8_t dataToSend[] = {1, 2, 3, 4, 5};
 const uint8_t disableDataToSend[] = {0xFE, 0, 0, 0, 0};
 const uint8_t restartDataToSend[] = {0xFF, 0, 0, 0, 0};
+const uint8_t goingAwayData[] = {0xFD};
+const uint8_t slowDataToSend[] = {0xFC, 0, 0, 0, 0};
 static const char* TAG = "pl_tcp_server_test";
 
 //==============================================================================
@@ -51,19 +59,156 @@ void TestTcp() {
   TEST_ASSERT(CompareEndpoints(ipV6Client.GetRemoteEndpoint(), serverStreams[1]->GetLocalEndpoint()));
 
   uint8_t receivedData[sizeof(dataToSend)];
+  TEST_ASSERT(ipV4Client.GetStream()->WaitForData(0) == ESP_ERR_TIMEOUT);
   TEST_ASSERT(ipV4Client.GetStream()->Write(dataToSend, sizeof(dataToSend)) == ESP_OK);
+  TEST_ASSERT(ipV4Client.GetStream()->WaitForData(readTimeout) == ESP_OK);
   TEST_ASSERT(ipV4Client.GetStream()->Read(receivedData, sizeof(dataToSend)) == ESP_OK);
   for (int i = 0; i < sizeof(dataToSend); i++)
     TEST_ASSERT_EQUAL(dataToSend[i], receivedData[i]);
 
+  PL::NetworkStreamStatistics streamStatistics = ipV4Client.GetStream()->GetStatistics();
+  TEST_ASSERT_EQUAL(sizeof(dataToSend), streamStatistics.numberOfBytesWritten);
+  TEST_ASSERT_EQUAL(sizeof(dataToSend), streamStatistics.numberOfBytesRead);
+  TEST_ASSERT(streamStatistics.closeReason == PL::NetworkStreamCloseReason::none);
+  vTaskDelay(10);
+  TEST_ASSERT(server.GetStatistics().numberOfHandledRequests);
+
+  // Data hidden by the exhausted shared rate limit is still reported by WaitForData
+  auto sharedTokenBucket = std::make_shared<PL::SharedTokenBucket>();
+  TEST_ASSERT(sharedTokenBucket->SetRate(1, 1) == ESP_OK);
+  sharedTokenBucket->Take(1);
+  TEST_ASSERT(ipV4Client.GetStream()->SetSharedReadTokenBucket(sharedTokenBucket) == ESP_OK);
+  TEST_ASSERT(ipV4Client.GetStream()->Write(dataToSend, sizeof(dataToSend)) == ESP_OK);
+  TEST_ASSERT(ipV4Client.GetStream()->WaitForData(readTimeout) == ESP_OK);
+  TEST_ASSERT_EQUAL(0, ipV4Client.GetStream()->GetReadableSize());
+  TEST_ASSERT(ipV4Client.GetStream()->IsOpen());
+  TEST_ASSERT(ipV4Client.GetStream()->SetSharedReadTokenBucket(nullptr) == ESP_OK);
+  TEST_ASSERT(ipV4Client.GetStream()->Read(receivedData, sizeof(dataToSend)) == ESP_OK);
+
   TEST_ASSERT(ipV6Client.GetStream()->Write(dataToSend, sizeof(dataToSend)) == ESP_OK);
   TEST_ASSERT(ipV6Client.GetStream()->Read(receivedData, sizeof(dataToSend)) == ESP_OK);
   for (int i = 0; i < sizeof(dataToSend); i++)
     TEST_ASSERT_EQUAL(dataToSend[i], receivedData[i]);
 
+  // Test stream and server data rate limits
+  uint8_t rateLimitedData[300] = {};
+  TEST_ASSERT(ipV4Client.GetStream()->SetWriteRateLimit(1000, 100) == ESP_OK);
+  TickType_t startTime = xTaskGetTickCount();
+  TEST_ASSERT(ipV4Client.GetStream()->Write(rateLimitedData, sizeof(rateLimitedData)) == ESP_OK);
+  TEST_ASSERT(xTaskGetTickCount() - startTime >= 150 / portTICK_PERIOD_MS);
+  TEST_ASSERT(ipV4Client.GetStream()->Read(rateLimitedData, sizeof(rateLimitedData)) == ESP_OK);
+  TEST_ASSERT(ipV4Client.GetStream()->SetWriteRateLimit(0, 0) == ESP_OK);
+
+  TEST_ASSERT(server.SetReadRateLimit(1000, 100) == ESP_OK);
+  startTime = xTaskGetTickCount();
+  TEST_ASSERT(ipV6Client.GetStream()->Write(rateLimitedData, sizeof(rateLimitedData)) == ESP_OK);
+  TEST_ASSERT(ipV6Client.GetStream()->Read(rateLimitedData, sizeof(rateLimitedData)) == ESP_OK);
+  TEST_ASSERT(xTaskGetTickCount() - startTime >= 150 / portTICK_PERIOD_MS);
+
+  // Test that the server handles an exempt client while the other client is limited by the total rate limit
+  TEST_ASSERT(serverStreams[0]->SetSharedRateLimitExempt(true) == ESP_OK);
+  TEST_ASSERT(serverStreams[0]->IsSharedRateLimitExempt());
+  vTaskDelay(150 / portTICK_PERIOD_MS);
+  TEST_ASSERT(ipV6Client.GetStream()->Write(rateLimitedData, sizeof(rateLimitedData)) == ESP_OK);
+  vTaskDelay(10);
+  startTime = xTaskGetTickCount();
+  TEST_ASSERT(ipV4Client.GetStream()->Write(dataToSend, sizeof(dataToSend)) == ESP_OK);
+  TEST_ASSERT(ipV4Client.GetStream()->Read(receivedData, sizeof(dataToSend)) == ESP_OK);
+  TEST_ASSERT(xTaskGetTickCount() - startTime < 100 / portTICK_PERIOD_MS);
+  TEST_ASSERT(ipV6Client.GetStream()->Read(rateLimitedData, sizeof(rateLimitedData)) == ESP_OK);
+  TEST_ASSERT(serverStreams[0]->SetSharedRateLimitExempt(false) == ESP_OK);
+  TEST_ASSERT(server.SetReadRateLimit(0, 0) == ESP_OK);
+
+  // Test buffer allocator and read data discard
+  auto bufferAllocator = PL::NetworkBufferAllocator::GetDefault();
+  void* buffer = bufferAllocator->Allocate(100);
+  TEST_ASSERT(buffer);
+  size_t numberOfFreeBuffers = bufferAllocator->GetNumberOfFreeBuffers();
+  bufferAllocator->Free(buffer, 100);
+  TEST_ASSERT_EQUAL(numberOfFreeBuffers + 1, bufferAllocator->GetNumberOfFreeBuffers());
+  TEST_ASSERT(bufferAllocator->Allocate(PL::NetworkBufferAllocator::minSizeClass * 2) == buffer);
+  bufferAllocator->Free(buffer, PL::NetworkBufferAllocator::minSizeClass * 2);
+  // Discard buffer is taken from the stream allocator and returned to it
+  auto streamBufferAllocator = std::make_shared<PL::NetworkBufferAllocator>(MALLOC_CAP_DEFAULT);
+  TEST_ASSERT(ipV4Client.GetStream()->SetBufferAllocator(streamBufferAllocator) == ESP_OK);
+  TEST_ASSERT(ipV4Client.GetStream()->GetBufferAllocator() == streamBufferAllocator);
+  TEST_ASSERT(ipV4Client.GetStream()->Write(rateLimitedData, sizeof(rateLimitedData)) == ESP_OK);
+  TEST_ASSERT(ipV4Client.GetStream()->Read(NULL, sizeof(rateLimitedData)) == ESP_OK);
+  TEST_ASSERT_EQUAL(0, ipV4Client.GetStream()->GetReadableSize());
+  TEST_ASSERT(ipV4Client.GetStream()->SetBufferAllocator(nullptr) == ESP_OK);
+  TEST_ASSERT_EQUAL(1, streamBufferAllocator->GetNumberOfFreeBuffers());
+  // Client event rings are moved to the server allocator
+  auto serverBufferAllocator = std::make_shared<PL::NetworkBufferAllocator>(MALLOC_CAP_DEFAULT);
+  TEST_ASSERT(server.SetBufferAllocator(serverBufferAllocator) == ESP_OK);
+  TEST_ASSERT(server.GetBufferAllocator() == serverBufferAllocator);
+  TEST_ASSERT(serverStreams[0]->GetBufferAllocator() == serverBufferAllocator);
+  TEST_ASSERT(server.SetBufferAllocator(nullptr) == ESP_OK);
+  TEST_ASSERT_EQUAL(1, serverBufferAllocator->GetNumberOfFreeBuffers());
+
+  // Test request handling budget (one byte per handler call)
+  TEST_ASSERT(server.SetHandleRequestBudget(1, 0) == ESP_OK);
+  uint32_t numberOfHandledRequests = server.GetStatistics().numberOfHandledRequests;
+  TEST_ASSERT(ipV4Client.GetStream()->Write(dataToSend, sizeof(dataToSend)) == ESP_OK);
+  TEST_ASSERT(ipV4Client.GetStream()->Read(receivedData, sizeof(dataToSend)) == ESP_OK);
+  for (int i = 0; i < sizeof(dataToSend); i++)
+    TEST_ASSERT_EQUAL(dataToSend[i], receivedData[i]);
+  vTaskDelay(10);
+  TEST_ASSERT(server.GetStatistics().numberOfHandledRequests - numberOfHandledRequests >= sizeof(dataToSend));
+  TEST_ASSERT(server.SetHandleRequestBudget(0, 0) == ESP_OK);
+  TEST_ASSERT_EQUAL(PL::NetworkStream::defaultWeight, serverStreams[0]->GetWeight());
+  TEST_ASSERT(serverStreams[0]->SetWeight(0) == ESP_ERR_INVALID_ARG);
+  TEST_ASSERT(serverStreams[0]->SetWeight(2) == ESP_OK);
+  TEST_ASSERT_EQUAL(2, serverStreams[0]->GetWeight());
+
+  // Test socket profiles
+  PL::SocketProfile socketProfile;
+  socketProfile.nagleAlgorithmEnabled = false;
+  socketProfile.keepAliveEnabled = true;
+  socketProfile.keepAliveIdleTime = 60;
+  TEST_ASSERT(server.SetSocketProfile(socketProfile) == ESP_OK);
+  TEST_ASSERT(!server.GetSocketProfile().nagleAlgorithmEnabled);
+  TEST_ASSERT_EQUAL(60, server.GetSocketProfile().keepAliveIdleTime);
+  TEST_ASSERT(ipV4Client.SetSocketProfile(socketProfile) == ESP_OK);
+  TEST_ASSERT(ipV4Client.GetSocketProfile().keepAliveEnabled);
+  TEST_ASSERT(ipV4Client.GetStream()->Write(dataToSend, sizeof(dataToSend)) == ESP_OK);
+  TEST_ASSERT(ipV4Client.GetStream()->Read(receivedData, sizeof(dataToSend)) == ESP_OK);
+  TEST_ASSERT(server.SetSocketProfile(PL::SocketProfile::Control()) == ESP_OK);
+  TEST_ASSERT_EQUAL(PL::SocketProfile::Control().dscp, server.GetSocketProfile().dscp);
+  TEST_ASSERT(ipV4Client.SetSocketProfile(PL::SocketProfile::Bulk()) == ESP_OK);
+  socketProfile.dscp = PL::SocketProfile::maxDscp + 1;
+  TEST_ASSERT(server.SetSocketProfile(socketProfile) == ESP_ERR_INVALID_ARG);
+  TEST_ASSERT(ipV4Client.SetSocketProfile(socketProfile) == ESP_ERR_INVALID_ARG);
+  // Rejected profiles are not stored
+  TEST_ASSERT_EQUAL(PL::SocketProfile::Control().dscp, server.GetSocketProfile().dscp);
+  TEST_ASSERT_EQUAL(PL::SocketProfile::Bulk().dscp, ipV4Client.GetSocketProfile().dscp);
+#if !CONFIG_IDF_TARGET_LINUX
+  socketProfile.dscp = -1;
+  socketProfile.sendBufferSize = 4096;
+  TEST_ASSERT(server.SetSocketProfile(socketProfile) == ESP_ERR_NOT_SUPPORTED);
+  TEST_ASSERT(ipV4Client.SetSocketProfile(socketProfile) == ESP_ERR_NOT_SUPPORTED);
+  TEST_ASSERT_EQUAL(0, server.GetSocketProfile().sendBufferSize);
+  TEST_ASSERT_EQUAL(0, ipV4Client.GetSocketProfile().sendBufferSize);
+#endif
+  TEST_ASSERT(ipV4Client.GetStream()->Write(dataToSend, sizeof(dataToSend)) == ESP_OK);
+  TEST_ASSERT(ipV4Client.GetStream()->Read(receivedData, sizeof(dataToSend)) == ESP_OK);
+  TEST_ASSERT(server.SetSocketProfile(PL::SocketProfile()) == ESP_OK);
+  TEST_ASSERT(ipV4Client.SetSocketProfile(PL::SocketProfile()) == ESP_OK);
+
+  // Test live reconfiguration (connected clients are kept)
+  TEST_ASSERT(server.SetKeepAliveIdleTime(100) == ESP_OK);
+  TEST_ASSERT(server.SetMaxNumberOfClients(maxNumberOfClients) == ESP_OK);
+  PL::TaskParameters taskParameters = PL::TcpServer::defaultTaskParameters;
+  taskParameters.stackDepth += 1024;
+  TEST_ASSERT(server.SetTaskParameters(taskParameters) == ESP_OK);
+  TEST_ASSERT(server.IsEnabled());
   port++;
   TEST_ASSERT(server.SetPort(port) == ESP_OK);
   TEST_ASSERT(server.IsEnabled());
+  TEST_ASSERT(ipV4Client.IsConnected());
+  TEST_ASSERT(ipV4Client.GetStream()->Write(dataToSend, sizeof(dataToSend)) == ESP_OK);
+  TEST_ASSERT(ipV4Client.GetStream()->Read(receivedData, sizeof(dataToSend)) == ESP_OK);
+  TEST_ASSERT_EQUAL(2, server.GetClientStreams().size());
+  TEST_ASSERT(server.SetTaskParameters(PL::TcpServer::defaultTaskParameters) == ESP_OK);
   TEST_ASSERT(ipV4Client.SetRemoteEndpoint(ipV4Address, port) == ESP_OK);
   TEST_ASSERT(ipV6Client.SetRemoteEndpoint(ipV6Address, port) == ESP_OK);
   TEST_ASSERT(!ipV4Client.IsConnected());
@@ -86,6 +231,113 @@ void TestTcp() {
   vTaskDelay(10);
   TEST_ASSERT_EQUAL(0, server.GetClientStreams().size());
 
+  // Test client access rules
+  TEST_ASSERT(server.DenyClients(PL::NetworkAddressPrefix(PL::IpV4Address(127, 0, 0, 0), 8)) == ESP_OK);
+  TEST_ASSERT(!server.IsClientAllowed(ipV4Address));
+  TEST_ASSERT(server.IsClientAllowed(ipV6Address));
+  TEST_ASSERT(ipV4Client.Connect() == ESP_OK);
+  TEST_ASSERT(ipV6Client.Connect() == ESP_OK);
+  vTaskDelay(10);
+  serverStreams = server.GetClientStreams();
+  TEST_ASSERT_EQUAL(1, serverStreams.size());
+  TEST_ASSERT(CompareEndpoints(ipV6Client.GetLocalEndpoint(), serverStreams[0]->GetRemoteEndpoint()));
+  TEST_ASSERT(ipV4Client.Disconnect() == ESP_OK);
+  TEST_ASSERT(ipV6Client.Disconnect() == ESP_OK);
+  TEST_ASSERT(server.DenyClientsByDefault() == ESP_OK);
+  TEST_ASSERT(!server.IsClientAllowed(ipV6Address));
+  TEST_ASSERT(server.AllowClientsByDefault() == ESP_OK);
+  TEST_ASSERT(server.ClearClientAccessRules() == ESP_OK);
+  TEST_ASSERT(server.IsClientAllowed(ipV4Address));
+  vTaskDelay(10);
+  TEST_ASSERT_EQUAL(0, server.GetClientStreams().size());
+
+  // Test connection rate limit
+  TEST_ASSERT(server.SetClientConnectionRateLimit(1, 1) == ESP_OK);
+  TEST_ASSERT(ipV4Client.Connect() == ESP_OK);
+  vTaskDelay(10);
+  TEST_ASSERT(ipV4Client.Disconnect() == ESP_OK);
+  TEST_ASSERT(ipV4Client.Connect() == ESP_OK);
+  TEST_ASSERT(ipV6Client.Connect() == ESP_OK);
+  vTaskDelay(10);
+  TEST_ASSERT_EQUAL(1, server.GetNumberOfRateLimitedConnections());
+  TEST_ASSERT_EQUAL(1, server.GetClientStreams().size());
+  TEST_ASSERT(ipV4Client.Disconnect() == ESP_OK);
+  TEST_ASSERT(ipV6Client.Disconnect() == ESP_OK);
+  // Client addresses that do not fit into the tracked ones share one limit instead of replacing the limited addresses
+  TEST_ASSERT(server.SetClientConnectionRateLimit(1, 1, 1) == ESP_OK);
+  TEST_ASSERT(ipV4Client.Connect() == ESP_OK);
+  vTaskDelay(10);
+  TEST_ASSERT(ipV6Client.Connect() == ESP_OK);
+  vTaskDelay(10);
+  TEST_ASSERT_EQUAL(2, server.GetClientStreams().size());
+  TEST_ASSERT(ipV4Client.Disconnect() == ESP_OK);
+  TEST_ASSERT(ipV6Client.Disconnect() == ESP_OK);
+  TEST_ASSERT(ipV6Client.Connect() == ESP_OK);
+  vTaskDelay(10);
+  TEST_ASSERT(ipV4Client.Connect() == ESP_OK);
+  vTaskDelay(10);
+  TEST_ASSERT_EQUAL(3, server.GetNumberOfRateLimitedConnections());
+  TEST_ASSERT_EQUAL(0, server.GetClientStreams().size());
+  TEST_ASSERT(ipV4Client.Disconnect() == ESP_OK);
+  TEST_ASSERT(ipV6Client.Disconnect() == ESP_OK);
+  TEST_ASSERT(server.SetClientConnectionRateLimit(0, 0) == ESP_OK);
+  TEST_ASSERT(server.SetConnectionRateLimit(1, 1) == ESP_OK);
+  TEST_ASSERT(ipV4Client.Connect() == ESP_OK);
+  vTaskDelay(10);
+  TEST_ASSERT(ipV6Client.Connect() == ESP_OK);
+  vTaskDelay(10);
+  TEST_ASSERT_EQUAL(4, server.GetNumberOfRateLimitedConnections());
+  TEST_ASSERT_EQUAL(1, server.GetClientStreams().size());
+  TEST_ASSERT(ipV4Client.Disconnect() == ESP_OK);
+  TEST_ASSERT(ipV6Client.Disconnect() == ESP_OK);
+  TEST_ASSERT(server.SetConnectionRateLimit(0, 0) == ESP_OK);
+  vTaskDelay(10);
+
+  // Test memory budget
+  TEST_ASSERT(server.SetMemoryBudget(PL::TcpServer::defaultConnectionMemorySize, PL::TcpServer::defaultConnectionMemorySize, 0) == ESP_OK);
+  TEST_ASSERT(server.SetLowMemoryReceiveBufferSize(SIZE_MAX, 0) == ESP_ERR_INVALID_ARG);
+  TEST_ASSERT(server.SetLowMemoryReceiveBufferSize(SIZE_MAX, 2048) == ESP_OK);
+  TEST_ASSERT(ipV4Client.Connect() == ESP_OK);
+  vTaskDelay(10);
+  TEST_ASSERT(ipV6Client.Connect() == ESP_OK);
+  vTaskDelay(10);
+  TEST_ASSERT_EQUAL(1, server.GetClientStreams().size());
+  TEST_ASSERT(ipV4Client.GetStream()->Write(dataToSend, sizeof(dataToSend)) == ESP_OK);
+  TEST_ASSERT(ipV4Client.GetStream()->Read(receivedData, sizeof(dataToSend)) == ESP_OK);
+  TEST_ASSERT(ipV4Client.Disconnect() == ESP_OK);
+  TEST_ASSERT(ipV6Client.Disconnect() == ESP_OK);
+  TEST_ASSERT(server.SetMemoryBudget(PL::TcpServer::defaultConnectionMemorySize, 0, 0) == ESP_OK);
+  TEST_ASSERT(server.SetLowMemoryReceiveBufferSize(0, 0) == ESP_OK);
+  vTaskDelay(10);
+  TEST_ASSERT_EQUAL(0, server.GetClientStreams().size());
+  PL::TcpServerStatistics serverStatistics = server.GetStatistics();
+  TEST_ASSERT_EQUAL(1, serverStatistics.numberOfDeniedConnections);
+  TEST_ASSERT_EQUAL(4, serverStatistics.numberOfRateLimitedConnections);
+  TEST_ASSERT_EQUAL(1, serverStatistics.numberOfMemoryLimitedConnections);
+  TEST_ASSERT(serverStatistics.numberOfDisconnections[(int)PL::NetworkStreamCloseReason::remote]);
+
+  // Test stream reuse
+  PL::NetworkStream* ipV4ClientStream = ipV4Client.GetStream().get();
+  TEST_ASSERT(ipV4Client.Connect() == ESP_OK);
+  TEST_ASSERT(ipV4Client.GetStream().get() == ipV4ClientStream);
+  TEST_ASSERT_EQUAL(0, ipV4Client.GetStream()->GetStatistics().numberOfBytesRead);
+  TEST_ASSERT(ipV4Client.Disconnect() == ESP_OK);
+
+  PL::NetworkStreamPool streamPool(2);
+  auto poolStream1 = streamPool.Open(socket(AF_INET, SOCK_STREAM, IPPROTO_TCP));
+  auto poolStream2 = streamPool.Open(socket(AF_INET, SOCK_STREAM, IPPROTO_TCP));
+  TEST_ASSERT(poolStream1 && poolStream2 && poolStream1 != poolStream2);
+  TEST_ASSERT_EQUAL(0, streamPool.GetNumberOfFreeStreams());
+  TEST_ASSERT(poolStream1->Close() == ESP_OK);
+  TEST_ASSERT_EQUAL(0, streamPool.GetNumberOfFreeStreams());
+  PL::NetworkStream* poolStream1Pointer = poolStream1.get();
+  poolStream1.reset();
+  TEST_ASSERT_EQUAL(1, streamPool.GetNumberOfFreeStreams());
+  poolStream1 = streamPool.Open(socket(AF_INET, SOCK_STREAM, IPPROTO_TCP));
+  TEST_ASSERT(poolStream1.get() == poolStream1Pointer);
+  TEST_ASSERT(poolStream1->Close() == ESP_OK);
+  TEST_ASSERT(poolStream2->Close() == ESP_OK);
+
   // Test server disable and restart from request
   TEST_ASSERT(ipV4Client.Connect() == ESP_OK);
   TEST_ASSERT(ipV4Client.IsConnected());
@@ -101,8 +353,207 @@ void TestTcp() {
   vTaskDelay(10);
   TEST_ASSERT(server.IsEnabled());
 
+  // Test server setters that apply the settings to the client streams while a request handler that uses the server is running
+  TEST_ASSERT(ipV4Client.Disconnect() == ESP_OK);
+  TEST_ASSERT(ipV4Client.Connect() == ESP_OK);
+  TEST_ASSERT(ipV4Client.GetStream()->Write(slowDataToSend, sizeof(slowDataToSend)) == ESP_OK);
+  vTaskDelay(10);
+  TEST_ASSERT(server.SetKeepAliveCount(PL::TcpServer::defaultKeepAliveCount) == ESP_OK);
+  TEST_ASSERT(server.SetReadRateLimit(0, 0) == ESP_OK);
+  TEST_ASSERT(server.IsEnabled());
+
+  // Test server disable while a request handler that is longer than the disable timeout uses the server
+  TEST_ASSERT(ipV4Client.Disconnect() == ESP_OK);
+  TEST_ASSERT(ipV4Client.Connect() == ESP_OK);
+  TEST_ASSERT(ipV4Client.GetStream()->Write(slowDataToSend, sizeof(slowDataToSend)) == ESP_OK);
+  vTaskDelay(10);
+  TEST_ASSERT(server.Disable() == ESP_OK);
+  TEST_ASSERT(!server.IsEnabled());
+
+  // Test static task memory and client streams
+  TEST_ASSERT(ipV4Client.Disconnect() == ESP_OK);
+  static StackType_t taskStack[4096];
+  static StaticTask_t taskBuffer;
+  static PL::NetworkStream staticClientStreams[maxNumberOfClients];
+  TEST_ASSERT(server.SetStaticTaskMemory(taskStack, sizeof(taskStack) / sizeof(StackType_t), &taskBuffer) == ESP_OK);
+  TEST_ASSERT(server.SetStaticClientStreams(staticClientStreams, maxNumberOfClients) == ESP_OK);
+  TEST_ASSERT(server.SetMaxNumberOfClients(maxNumberOfClients + 1) == ESP_ERR_INVALID_ARG);
+  for (int i = 0; i < 2; i++) {
+    TEST_ASSERT(server.Enable() == ESP_OK);
+    vTaskDelay(10);
+    TEST_ASSERT(ipV4Client.Connect() == ESP_OK);
+    TEST_ASSERT(ipV4Client.GetStream()->Write(dataToSend, sizeof(dataToSend)) == ESP_OK);
+    TEST_ASSERT(ipV4Client.GetStream()->Read(receivedData, sizeof(dataToSend)) == ESP_OK);
+    serverStreams = server.GetClientStreams();
+    TEST_ASSERT_EQUAL(1, serverStreams.size());
+    TEST_ASSERT(serverStreams[0].get() >= staticClientStreams && serverStreams[0].get() < staticClientStreams + maxNumberOfClients);
+    serverStreams.clear();
+    TEST_ASSERT(ipV4Client.Disconnect() == ESP_OK);
+    TEST_ASSERT(server.Disable() == ESP_OK);
+  }
+  TEST_ASSERT(server.SetStaticTaskMemory(NULL, 0, NULL) == ESP_OK);
+  TEST_ASSERT(server.SetStaticClientStreams(NULL, 0) == ESP_OK);
+
+  // Test static server destruction while a request handler that is longer than the disable timeout is running
+  auto staticServer = std::make_unique<StaticTcpServer>(port);
+  TEST_ASSERT(staticServer->Enable() == ESP_OK);
+  vTaskDelay(10);
+  TEST_ASSERT(ipV4Client.Connect() == ESP_OK);
+  TEST_ASSERT(ipV4Client.GetStream()->Write(slowDataToSend, sizeof(slowDataToSend)) == ESP_OK);
+  vTaskDelay(10);
+  staticServer.reset();
+  TEST_ASSERT(ipV4Client.Disconnect() == ESP_OK);
+
+  // Test servers in a shared host task
+  PL::TcpServerHost host;
+  TcpServer secondServer(port + 1);
+  TEST_ASSERT(server.SetHost(&host) == ESP_OK);
+  TEST_ASSERT(secondServer.SetHost(&host) == ESP_OK);
+  TEST_ASSERT(server.Enable() == ESP_OK);
+  TEST_ASSERT(secondServer.Enable() == ESP_OK);
+  TEST_ASSERT(server.SetHost(NULL) == ESP_ERR_INVALID_STATE);
+  TEST_ASSERT_EQUAL(2, host.GetNumberOfServers());
+  vTaskDelay(10);
+  PL::TcpClient secondClient(ipV4Address, port + 1);
+  TEST_ASSERT(ipV4Client.Connect() == ESP_OK);
+  TEST_ASSERT(secondClient.Connect() == ESP_OK);
+  TEST_ASSERT(ipV4Client.GetStream()->Write(dataToSend, sizeof(dataToSend)) == ESP_OK);
+  TEST_ASSERT(secondClient.GetStream()->Write(dataToSend, sizeof(dataToSend)) == ESP_OK);
+  TEST_ASSERT(ipV4Client.GetStream()->Read(receivedData, sizeof(dataToSend)) == ESP_OK);
+  TEST_ASSERT(secondClient.GetStream()->Read(receivedData, sizeof(dataToSend)) == ESP_OK);
+  for (int i = 0; i < sizeof(dataToSend); i++)
+    TEST_ASSERT_EQUAL(dataToSend[i], receivedData[i]);
+  // Disable times out while the host task runs a request handler of the other server that is longer than the disable timeout
+  TEST_ASSERT(secondClient.GetStream()->Write(slowDataToSend, sizeof(slowDataToSend)) == ESP_OK);
+  vTaskDelay(2);
+  TEST_ASSERT(server.Disable() == ESP_ERR_TIMEOUT);
+  TEST_ASSERT(server.IsEnabled());
+  TEST_ASSERT(server.Enable() == ESP_ERR_INVALID_STATE);
+  vTaskDelay(20);
+  TEST_ASSERT(ipV4Client.Disconnect() == ESP_OK);
+  TEST_ASSERT(secondClient.Disconnect() == ESP_OK);
+  TEST_ASSERT(server.Disable() == ESP_OK);
+  TEST_ASSERT(!server.IsEnabled());
+  TEST_ASSERT(secondServer.IsEnabled());
+  TEST_ASSERT_EQUAL(1, host.GetNumberOfServers());
+  TEST_ASSERT(secondServer.Disable() == ESP_OK);
+  TEST_ASSERT_EQUAL(0, host.GetNumberOfServers());
+  TEST_ASSERT(server.SetHost(NULL) == ESP_OK);
+
+  // Test host destruction with an enabled server (the server is disabled and detached from the host)
+  auto temporaryHost = std::make_unique<PL::TcpServerHost>();
+  TEST_ASSERT(server.SetHost(temporaryHost.get()) == ESP_OK);
+  TEST_ASSERT(server.Enable() == ESP_OK);
+  vTaskDelay(10);
+  TEST_ASSERT(ipV4Client.Connect() == ESP_OK);
+  vTaskDelay(10);
+  TEST_ASSERT_EQUAL(1, server.GetClientStreams().size());
+  temporaryHost.reset();
+  TEST_ASSERT(!server.IsEnabled());
+  TEST_ASSERT_EQUAL(0, server.GetClientStreams().size());
+  TEST_ASSERT(ipV4Client.Disconnect() == ESP_OK);
+  TEST_ASSERT(server.Enable() == ESP_OK);
+  TEST_ASSERT(server.IsEnabled());
+  TEST_ASSERT(server.Disable() == ESP_OK);
+
+  // Test manual polling
+  TEST_ASSERT(server.Poll() == ESP_ERR_INVALID_STATE);
+  TEST_ASSERT(server.EnableManualPolling() == ESP_OK);
+  TEST_ASSERT(server.Enable() == ESP_OK);
+  TEST_ASSERT(server.IsEnabled());
+  TEST_ASSERT(server.Poll() == ESP_OK);
+  TEST_ASSERT(ipV4Client.Connect() == ESP_OK);
+  TEST_ASSERT(ipV4Client.GetStream()->Write(dataToSend, sizeof(dataToSend)) == ESP_OK);
+  for (int i = 0; i < 10 && ipV4Client.GetStream()->GetReadableSize() < sizeof(dataToSend); i++)
+    TEST_ASSERT(server.Poll(100 / portTICK_PERIOD_MS) == ESP_OK);
+  TEST_ASSERT_EQUAL(1, server.GetClientStreams().size());
+  TEST_ASSERT(ipV4Client.GetStream()->Read(receivedData, sizeof(dataToSend)) == ESP_OK);
+  for (int i = 0; i < sizeof(dataToSend); i++)
+    TEST_ASSERT_EQUAL(dataToSend[i], receivedData[i]);
+  TEST_ASSERT(server.DisableManualPolling() == ESP_ERR_INVALID_STATE);
+  TEST_ASSERT(ipV4Client.Disconnect() == ESP_OK);
   TEST_ASSERT(server.Disable() == ESP_OK);
   TEST_ASSERT(!server.IsEnabled());
+  TEST_ASSERT(server.Poll() == ESP_ERR_INVALID_STATE);
+  TEST_ASSERT(server.DisableManualPolling() == ESP_OK);
+
+  // Test drain
+  TEST_ASSERT(server.Enable() == ESP_OK);
+  vTaskDelay(10);
+  TEST_ASSERT(ipV4Client.Connect() == ESP_OK);
+  vTaskDelay(10);
+  TEST_ASSERT(server.Drain(100 / portTICK_PERIOD_MS) == ESP_OK);
+  TEST_ASSERT(!server.IsEnabled());
+  TEST_ASSERT(ipV4Client.GetStream()->Read(receivedData, sizeof(goingAwayData)) == ESP_OK);
+  TEST_ASSERT_EQUAL(goingAwayData[0], receivedData[0]);
+  TEST_ASSERT(ipV4Client.Disconnect() == ESP_OK);
+  TEST_ASSERT(server.Drain(100 / portTICK_PERIOD_MS) == ESP_OK);
+
+  // Test client events in the dispatcher task (the second event does not fit into the queue)
+  auto clientEventCounter = std::make_shared<ClientEventCounter>();
+  server.clientConnectedEvent.AddHandler(clientEventCounter, &ClientEventCounter::OnClientConnected);
+  server.clientDisconnectedEvent.AddHandler(clientEventCounter, &ClientEventCounter::OnClientDisconnected);
+  TEST_ASSERT(server.SetEventDispatchMode(PL::TcpServerEventDispatchMode::dispatcherTask, 0) == ESP_ERR_INVALID_ARG);
+  TEST_ASSERT(server.SetEventDispatchMode(PL::TcpServerEventDispatchMode::dispatcherTask, 1) == ESP_OK);
+  TEST_ASSERT(server.GetEventDispatchMode() == PL::TcpServerEventDispatchMode::dispatcherTask);
+  TEST_ASSERT(server.Enable() == ESP_OK);
+  TEST_ASSERT(server.SetEventDispatchMode(PL::TcpServerEventDispatchMode::immediate) == ESP_ERR_INVALID_STATE);
+  vTaskDelay(10);
+  TEST_ASSERT(ipV4Client.Connect() == ESP_OK);
+  TEST_ASSERT(ipV6Client.Connect() == ESP_OK);
+  vTaskDelay(10);
+  TEST_ASSERT(ipV4Client.Disconnect() == ESP_OK);
+  TEST_ASSERT(ipV6Client.Disconnect() == ESP_OK);
+  vTaskDelay(20);
+  TEST_ASSERT(server.Disable() == ESP_OK);
+  TEST_ASSERT(server.SetEventDispatchMode(PL::TcpServerEventDispatchMode::endOfIteration) == ESP_OK);
+  TEST_ASSERT_EQUAL(2, clientEventCounter->numberOfConnectedEvents);
+  TEST_ASSERT_EQUAL(2, clientEventCounter->numberOfDisconnectedEvents);
+  TEST_ASSERT(server.SetEventDispatchMode(PL::TcpServerEventDispatchMode::immediate) == ESP_OK);
+
+  // Test configuration setters in the client event handlers called by the server task
+  TEST_ASSERT(server.Enable() == ESP_OK);
+  vTaskDelay(10);
+  TEST_ASSERT(ipV4Client.Connect() == ESP_OK);
+  vTaskDelay(10);
+  TEST_ASSERT_EQUAL(3, clientEventCounter->numberOfConnectedEvents);
+  TEST_ASSERT(ipV4Client.Disconnect() == ESP_OK);
+  vTaskDelay(10);
+  TEST_ASSERT(server.Disable() == ESP_OK);
+
+  // Test repeated enable and disable
+  for (int i = 0; i < 10; i++) {
+    TEST_ASSERT(server.Enable() == ESP_OK);
+    TEST_ASSERT(server.IsEnabled());
+    TEST_ASSERT(server.Disable() == ESP_OK);
+    TEST_ASSERT(!server.IsEnabled());
+  }
+}
+
+//==============================================================================
+
+esp_err_t StaticTcpServer::HandleRequest(PL::NetworkStream& stream) {
+  uint8_t dataByte;
+  while (stream.GetReadableSize()) {
+    if (stream.Read(&dataByte, 1) == ESP_OK && dataByte == slowDataToSend[0])
+      vTaskDelay(PL::TcpServer::disableTimeout + 10);
+  }
+  return ESP_OK;
+}
+
+//==============================================================================
+
+void ClientEventCounter::OnClientConnected(PL::TcpServer& server, PL::NetworkStream& clientStream) {
+  numberOfConnectedEvents++;
+  // Each setter replaces the configuration
+  server.SetKeepAliveIdleTime(server.GetSocketProfile().keepAliveIdleTime);
+  server.SetKeepAliveCount(server.GetSocketProfile().keepAliveCount);
+}
+
+//==============================================================================
+
+void ClientEventCounter::OnClientDisconnected(PL::TcpServer& server, PL::NetworkStream& clientStream) {
+  numberOfDisconnectedEvents++;
 }
 
 //==============================================================================
@@ -114,6 +565,10 @@ esp_err_t TcpServer::HandleRequest(PL::NetworkStream& stream) {
       stream.Write(&dataByte, 1);
       if (dataByte == disableDataToSend[0])
         ESP_RETURN_ON_ERROR(Disable(), TAG, "server disable failed");
+      if (dataByte == slowDataToSend[0]) {
+        vTaskDelay(PL::TcpServer::disableTimeout + 10);
+        ESP_RETURN_ON_ERROR(SetKeepAliveIdleTime(PL::TcpServer::defaultKeepAliveIdleTime), TAG, "keep-alive idle time set failed");
+      }
       if (dataByte == restartDataToSend[0]) {
         ESP_RETURN_ON_ERROR(Disable(), TAG, "server disable failed");
         ESP_RETURN_ON_ERROR(Enable(), TAG, "server enable failed");
@@ -125,6 +580,12 @@ esp_err_t TcpServer::HandleRequest(PL::NetworkStream& stream) {
 
 //==============================================================================
 
+esp_err_t TcpServer::HandleDrain(PL::NetworkStream& stream) {
+  return stream.Write(goingAwayData, sizeof(goingAwayData));
+}
+
+//==============================================================================
+
 bool CompareEndpoints(const PL::NetworkEndpoint& ep1, const PL::NetworkEndpoint& ep2) {
   if (ep1.address.family != ep2.address.family || ep1.port != ep2.port)
     return false;
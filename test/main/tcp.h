@@ -8,6 +8,28 @@ public:
 
 protected:
   esp_err_t HandleRequest(PL::NetworkStream& clientStream) override;
+  esp_err_t HandleDrain(PL::NetworkStream& clientStream) override;
+};
+
+//==============================================================================
+
+class StaticTcpServer : public PL::StaticTcpServer<2> {
+public:
+  using PL::StaticTcpServer<2>::StaticTcpServer;
+
+protected:
+  esp_err_t HandleRequest(PL::NetworkStream& clientStream) override;
+};
+
+//==============================================================================
+
+class ClientEventCounter {
+public:
+  std::atomic<int> numberOfConnectedEvents = {0};
+  std::atomic<int> numberOfDisconnectedEvents = {0};
+
+  void OnClientConnected(PL::TcpServer& server, PL::NetworkStream& clientStream);
+  void OnClientDisconnected(PL::TcpServer& server, PL::NetworkStream& clientStream);
 };
 
 //==============================================================================